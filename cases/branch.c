@@ -56,6 +56,13 @@ static int branch_getopt(struct perf_case* p_case, int opt)
 	return SUCCESS;
 }
 
+static void branch_reset_opts(struct perf_case *p_case)
+{
+	opt_num = 1;
+	opt_pattern = BR_PAT_FIXED;
+	opt_iterations = 1000000;
+}
+
 static void use_it(int a)
 {
 	static int use = 0;
@@ -85,6 +92,18 @@ static int branch_exit(struct perf_case *p_case, struct perf_stat *p_stat)
 	return SUCCESS;
 }
 
+static int branch_get_iterations(struct perf_case *p_case)
+{
+	struct branch_data *p_data = (struct branch_data*)p_case->data;
+	return p_data->iterations;
+}
+
+static void branch_set_iterations(struct perf_case *p_case, int iterations)
+{
+	struct branch_data *p_data = (struct branch_data*)p_case->data;
+	p_data->iterations = iterations;
+}
+
 #define JUMP1(pri, maj, min, sub)				\
 	"b NEXT_BRANCH_" #pri "_" #maj "_" #min "_" #sub "\n"	\
 	"NEXT_BRANCH_" #pri "_"  #maj "_" #min "_" #sub ":\n"
@@ -276,6 +295,7 @@ static void branch_next_func(struct perf_case *p_case, struct perf_stat *p_stat)
 		err = 1;
 	}
 	perf_stat_end(p_stat);
+	perf_stat_add_metric(p_stat, "branches", "ops", (double)num * loops);
 	if (err) {
 		printf("ERROR: Only support n = 2^[0~14]\n");
 		exit(0);
@@ -290,6 +310,9 @@ PERF_CASE_DEFINE(branch_next) = {
 	.desc = "jump to next instruction for n times.",
 	.init = branch_init,
 	.exit = branch_exit,
+	.get_iterations = branch_get_iterations,
+	.set_iterations = branch_set_iterations,
+	.reset_opts = branch_reset_opts,
 	.func = branch_next_func,
 	.getopt = branch_getopt,
 	.opts = branch_next_opts,
@@ -331,6 +354,7 @@ static void branch_pred_func(struct perf_case *p_case, struct perf_stat *p_stat)
 		if (deciecions[i])
 			sum++;
 	perf_stat_end(p_stat);
+	perf_stat_add_metric(p_stat, "branches", "ops", loops);
 	printf("pred: %d, taken: %d\n", i, sum);
 	free(deciecions);
 }
@@ -341,6 +365,9 @@ PERF_CASE_DEFINE(branch_pred) = {
 	.desc = "if loop with fixed/random condition pattern.",
 	.init = branch_init,
 	.exit = branch_exit,
+	.get_iterations = branch_get_iterations,
+	.set_iterations = branch_set_iterations,
+	.reset_opts = branch_reset_opts,
 	.func = branch_pred_func,
 	.getopt = branch_getopt,
 	.opts = branch_pred_opts,
@@ -33,6 +33,12 @@ static int cpufp_getopt(struct perf_case* p_case, int opt)
 	return SUCCESS;
 }
 
+static void cpufp_reset_opts(struct perf_case *p_case)
+{
+	opt_num = 1;
+	opt_iterations = 1000000;
+}
+
 static void use_it(int a)
 {
 	static int use = 0;
@@ -64,6 +70,18 @@ static int cpufp_exit(struct perf_case *p_case, struct perf_stat *p_stat)
 	return SUCCESS;
 }
 
+static int cpufp_get_iterations(struct perf_case *p_case)
+{
+	struct cpufp_data *p_data = (struct cpufp_data*)p_case->data;
+	return p_data->iterations;
+}
+
+static void cpufp_set_iterations(struct perf_case *p_case, int iterations)
+{
+	struct cpufp_data *p_data = (struct cpufp_data*)p_case->data;
+	p_data->iterations = iterations;
+}
+
 #pragma GCC push_options
 #pragma GCC optimize ("O0")
 /* NOTE: INT & FP Instructions can run parallel, each loop contains ADD,CMP,FMOV,FADD,B */
@@ -104,6 +122,7 @@ static void cpufp_add_func(struct perf_case *p_case, struct perf_stat *p_stat)
 		}
 	}
 	perf_stat_end(p_stat);
+	perf_stat_add_metric(p_stat, "ops", "ops", (double)num * loops);
 	use_it(a);use_it(b);use_it(c);use_it(d);use_it(e);use_it(f);
 }
 #pragma GCC pop_options
@@ -113,6 +132,9 @@ PERF_CASE_DEFINE(cpufp_add) = {
 	.desc = "simple fp add loop.",
 	.init = cpufp_init,
 	.exit = cpufp_exit,
+	.get_iterations = cpufp_get_iterations,
+	.set_iterations = cpufp_set_iterations,
+	.reset_opts = cpufp_reset_opts,
 	.func = cpufp_add_func,
 	.getopt = cpufp_getopt,
 	.opts = cpufp_opts,
@@ -160,6 +182,7 @@ static void cpufp_mul_func(struct perf_case *p_case, struct perf_stat *p_stat)
 		}
 	}
 	perf_stat_end(p_stat);
+	perf_stat_add_metric(p_stat, "ops", "ops", (double)num * loops);
 	use_it(a);use_it(b);use_it(c);use_it(d);use_it(e);use_it(f);
 }
 #pragma GCC pop_options
@@ -169,6 +192,9 @@ PERF_CASE_DEFINE(cpufp_mul) = {
 	.desc = "simple fp mul loop.",
 	.init = cpufp_init,
 	.exit = cpufp_exit,
+	.get_iterations = cpufp_get_iterations,
+	.set_iterations = cpufp_set_iterations,
+	.reset_opts = cpufp_reset_opts,
 	.func = cpufp_mul_func,
 	.getopt = cpufp_getopt,
 	.opts = cpufp_opts,
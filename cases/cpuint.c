@@ -33,6 +33,12 @@ static int cpuint_getopt(struct perf_case* p_case, int opt)
 	return SUCCESS;
 }
 
+static void cpuint_reset_opts(struct perf_case *p_case)
+{
+	opt_num = 1;
+	opt_iterations = 1000000;
+}
+
 static void use_it(int a)
 {
 	static int use = 0;
@@ -64,6 +70,18 @@ static int cpuint_exit(struct perf_case *p_case, struct perf_stat *p_stat)
 	return SUCCESS;
 }
 
+static int cpuint_get_iterations(struct perf_case *p_case)
+{
+	struct cpuint_data *p_data = (struct cpuint_data*)p_case->data;
+	return p_data->iterations;
+}
+
+static void cpuint_set_iterations(struct perf_case *p_case, int iterations)
+{
+	struct cpuint_data *p_data = (struct cpuint_data*)p_case->data;
+	p_data->iterations = iterations;
+}
+
 #pragma GCC push_options
 #pragma GCC optimize ("O0")
 /* NOTE: Each loop contains two extra CMP,BNE instructions. */
@@ -104,6 +122,7 @@ static void cpuint_add_func(struct perf_case *p_case, struct perf_stat *p_stat)
 		}
 	}
 	perf_stat_end(p_stat);
+	perf_stat_add_metric(p_stat, "ops", "ops", (double)num * loops);
 	use_it(a);use_it(b);use_it(c);use_it(d);use_it(e);use_it(f);
 }
 #pragma GCC pop_options
@@ -113,6 +132,9 @@ PERF_CASE_DEFINE(cpuint_add) = {
 	.desc = "simple int add loop.",
 	.init = cpuint_init,
 	.exit = cpuint_exit,
+	.get_iterations = cpuint_get_iterations,
+	.set_iterations = cpuint_set_iterations,
+	.reset_opts = cpuint_reset_opts,
 	.func = cpuint_add_func,
 	.getopt = cpuint_getopt,
 	.opts = cpuint_opts,
@@ -161,6 +183,7 @@ static void cpuint_mul_func(struct perf_case *p_case, struct perf_stat *p_stat)
 		}
 	}
 	perf_stat_end(p_stat);
+	perf_stat_add_metric(p_stat, "ops", "ops", (double)num * loops);
 	use_it(a);use_it(b);use_it(c);use_it(d);use_it(e);use_it(f);
 }
 #pragma GCC pop_options
@@ -170,6 +193,9 @@ PERF_CASE_DEFINE(cpuint_mul) = {
 	.desc = "simple int mul loop.",
 	.init = cpuint_init,
 	.exit = cpuint_exit,
+	.get_iterations = cpuint_get_iterations,
+	.set_iterations = cpuint_set_iterations,
+	.reset_opts = cpuint_reset_opts,
 	.func = cpuint_mul_func,
 	.getopt = cpuint_getopt,
 	.opts = cpuint_opts,
@@ -35,6 +35,12 @@ static int cpusimd_getopt(struct perf_case* p_case, int opt)
 	return SUCCESS;
 }
 
+static void cpusimd_reset_opts(struct perf_case *p_case)
+{
+	opt_num = 1;
+	opt_iterations = 1000000;
+}
+
 static int cpusimd_init(struct perf_case *p_case, struct perf_stat *p_stat, int argc, char *argv[])
 {
 	struct cpusimd_data *p_data;
@@ -60,6 +66,18 @@ static int cpusimd_exit(struct perf_case *p_case, struct perf_stat *p_stat)
 	return SUCCESS;
 }
 
+static int cpusimd_get_iterations(struct perf_case *p_case)
+{
+	struct cpusimd_data *p_data = (struct cpusimd_data*)p_case->data;
+	return p_data->iterations;
+}
+
+static void cpusimd_set_iterations(struct perf_case *p_case, int iterations)
+{
+	struct cpusimd_data *p_data = (struct cpusimd_data*)p_case->data;
+	p_data->iterations = iterations;
+}
+
 static float32x4_t a = {1.0, 1.0, 1.0, 1.0};
 static float32x4_t b = {2.0, 2.0, 2.0, 2.0};
 static float32x4_t c = {3.0, 3.0, 3.0, 3.0};
@@ -127,6 +145,7 @@ static void cpusimd_add_func(struct perf_case *p_case, struct perf_stat *p_stat)
 		}
 	}
 	perf_stat_end(p_stat);
+	perf_stat_add_metric(p_stat, "ops", "ops", (double)num * loops);
 	/* Consume the data to avoid compiler optimizing. */
 	vst1q_f32(output, a);
 	vst1q_f32(output, b);
@@ -141,6 +160,9 @@ PERF_CASE_DEFINE(cpusimd_add) = {
 	.desc = "simple simd add loop.",
 	.init = cpusimd_init,
 	.exit = cpusimd_exit,
+	.get_iterations = cpusimd_get_iterations,
+	.set_iterations = cpusimd_set_iterations,
+	.reset_opts = cpusimd_reset_opts,
 	.func = cpusimd_add_func,
 	.getopt = cpusimd_getopt,
 	.opts = cpusimd_opts,
@@ -208,6 +230,7 @@ static void cpusimd_mul_func(struct perf_case *p_case, struct perf_stat *p_stat)
 		}
 	}
 	perf_stat_end(p_stat);
+	perf_stat_add_metric(p_stat, "ops", "ops", (double)num * loops);
 	/* Consume the data to avoid compiler optimizing. */
 	vst1q_f32(output, a);
 	vst1q_f32(output, b);
@@ -222,6 +245,9 @@ PERF_CASE_DEFINE(cpusimd_mul) = {
 	.desc = "simple simd mul loop.",
 	.init = cpusimd_init,
 	.exit = cpusimd_exit,
+	.get_iterations = cpusimd_get_iterations,
+	.set_iterations = cpusimd_set_iterations,
+	.reset_opts = cpusimd_reset_opts,
 	.func = cpusimd_mul_func,
 	.getopt = cpusimd_getopt,
 	.opts = cpusimd_opts,
@@ -8,12 +8,11 @@
 #include "perf_case.h"
 
 #define BUF_SIZE (128 * 1024 * 1024)
+#define SLICE_ALIGN 4096
 
 struct membw_data {
 	void *buf;
 	void *src;
-	void *buf_end;
-	void *src_end;
 	int buf_size;
 	int stride;
 	int iterations;
@@ -52,6 +51,13 @@ static int membw_getopt(struct perf_case* p_case, int opt)
 	return SUCCESS;
 }
 
+static void membw_reset_opts(struct perf_case *p_case)
+{
+	opt_buf_size = BUF_SIZE;
+	opt_stride = 1;
+	opt_iterations = 1;
+}
+
 static int membw_init(struct perf_case *p_case, struct perf_stat *p_stat, int argc, char *argv[])
 {
 	struct membw_data *p_data;
@@ -77,9 +83,6 @@ static int membw_init(struct perf_case *p_case, struct perf_stat *p_stat, int ar
 	memset(p_data->buf, 0x1, p_data->buf_size);
 	memset(p_data->src, 0x1, p_data->buf_size);
 
-	p_data->buf_end = (char*)p_data->buf + p_data->buf_size;
-	p_data->src_end = (char*)p_data->src + p_data->buf_size;
-
 	return SUCCESS;
 
 ERR_EXIT_2:
@@ -100,6 +103,27 @@ static int membw_exit(struct perf_case *p_case, struct perf_stat *p_stat)
 	return SUCCESS;
 }
 
+static int membw_get_iterations(struct perf_case *p_case)
+{
+	struct membw_data *p_data = (struct membw_data*)p_case->data;
+	return p_data->iterations;
+}
+
+static void membw_set_iterations(struct perf_case *p_case, int iterations)
+{
+	struct membw_data *p_data = (struct membw_data*)p_case->data;
+	p_data->iterations = iterations;
+}
+
+// With threads each one works on its own slice of the buffers.
+static void membw_slice(struct membw_data *p_data, struct perf_stat *p_stat, int *offset, int *size)
+{
+	int slice = (p_data->buf_size / p_stat->thread_num) & ~(SLICE_ALIGN - 1);
+
+	*offset = slice * p_stat->thread_id;
+	*size = p_stat->thread_id == p_stat->thread_num - 1 ? p_data->buf_size - *offset : slice;
+}
+
 static void print_bandwidth(int width, int stride, int buf_size, int iterations, struct perf_stat *p_stat, int nx)
 {
 	double size_mb = (double)buf_size / 1024 / 1024;
@@ -112,30 +136,35 @@ static void print_bandwidth(int width, int stride, int buf_size, int iterations,
 	printf("stride: %d bytes\n", stride);
 	printf("iterations: %d\n", iterations);
 	printf("%.3f MB/s (%f ms)\n", size_mb / time_ms, time_ms);
+	perf_stat_add_metric(p_stat, "bandwidth", "MB/s", size_mb / time_ms);
 }
 
 #define MEMBW_RD_PREPARE(_type)							\
 	struct membw_data *p_data = (struct membw_data*)p_case->data;		\
 	volatile _type *p;							\
-	_type *end = (_type*)p_data->buf_end;					\
+	_type *buf, *end;							\
 	int step = p_data->stride / sizeof(_type);				\
-	int sum;
+	int offset, size;							\
+	int sum;								\
+	membw_slice(p_data, p_stat, &offset, &size);				\
+	buf = (_type*)((char*)p_data->buf + offset);				\
+	end = (_type*)((char*)p_data->buf + offset + size);
 
 #define MEMBW_RD_WORKLOAD(_type)						\
 	step = step < 1 ? 1 : step;						\
 	perf_stat_begin(p_stat);						\
 	for (int i = 0; i < p_data->iterations; i++)				\
-		for (p = (_type*)p_data->buf; p < end; p += step)		\
+		for (p = buf; p < end; p += step)		\
 			sum += *p;						\
 	perf_stat_end(p_stat);							\
 	print_bandwidth(sizeof(*p) * 8, step * sizeof(*p), 			\
-		p_data->buf_size, p_data->iterations, p_stat, 1);
+		size, p_data->iterations, p_stat, 1);
 
 #define MEMBW_RD_WORKLOAD_4X(_type)						\
 	step = step < 4 ? 4 : step;						\
 	perf_stat_begin(p_stat);						\
 	for (int i = 0; i < p_data->iterations; i++) {				\
-		for (p = (_type*)p_data->buf; p < end; p += step) {		\
+		for (p = buf; p < end; p += step) {		\
 			sum += *p;						\
 			sum += *(p + 1);					\
 			sum += *(p + 2);					\
@@ -144,7 +173,7 @@ static void print_bandwidth(int width, int stride, int buf_size, int iterations,
 	}									\
 	perf_stat_end(p_stat);							\
 	print_bandwidth(sizeof(*p) * 8, step * sizeof(*p), 			\
-		p_data->buf_size, p_data->iterations, p_stat, 4);
+		size, p_data->iterations, p_stat, 4);
 
 static void membw_rd_1(struct perf_case *p_case, struct perf_stat *p_stat)
 {
@@ -185,24 +214,28 @@ static void membw_rd_8_4x(struct perf_case *p_case, struct perf_stat *p_stat)
 #define MEMBW_WR_PREPARE(_type)							\
 	struct membw_data *p_data = (struct membw_data*)p_case->data;		\
 	volatile _type *p;							\
-	_type *end = (_type*)p_data->buf_end;					\
-	int step = p_data->stride / sizeof(_type);
+	_type *buf, *end;							\
+	int step = p_data->stride / sizeof(_type);				\
+	int offset, size;							\
+	membw_slice(p_data, p_stat, &offset, &size);				\
+	buf = (_type*)((char*)p_data->buf + offset);				\
+	end = (_type*)((char*)p_data->buf + offset + size);
 
 #define MEMBW_WR_WORKLOAD(_type)						\
 	step = step < 1 ? 1 : step;						\
 	perf_stat_begin(p_stat);						\
 	for (int i = 0; i < p_data->iterations; i++)				\
-		for (p = (_type*)p_data->buf; p < end; p += step)		\
+		for (p = buf; p < end; p += step)		\
 			*p = 1;							\
 	perf_stat_end(p_stat);							\
 	print_bandwidth(sizeof(*p) * 8, step * sizeof(*p), 			\
-		p_data->buf_size, p_data->iterations, p_stat, 1);
+		size, p_data->iterations, p_stat, 1);
 
 #define MEMBW_WR_WORKLOAD_4X(_type)						\
 	step = step < 4 ? 4 : step;						\
 	perf_stat_begin(p_stat);						\
 	for (int i = 0; i < p_data->iterations; i++) {				\
-		for (p = (_type*)p_data->buf; p < end; p += step) {		\
+		for (p = buf; p < end; p += step) {		\
 			*p = 1;							\
 			*(p + 1) = 1;						\
 			*(p + 2) = 1;						\
@@ -211,7 +244,7 @@ static void membw_rd_8_4x(struct perf_case *p_case, struct perf_stat *p_stat)
 	}									\
 	perf_stat_end(p_stat);							\
 	print_bandwidth(sizeof(*p) * 8, step * sizeof(*p), 			\
-		p_data->buf_size, p_data->iterations, p_stat, 4);
+		size, p_data->iterations, p_stat, 4);
 
 static void membw_wr_1(struct perf_case *p_case, struct perf_stat *p_stat)
 {
@@ -252,25 +285,30 @@ static void membw_wr_8_4x(struct perf_case *p_case, struct perf_stat *p_stat)
 #define MEMBW_CP_PREPARE(_type)							\
 	struct membw_data *p_data = (struct membw_data*)p_case->data;		\
 	volatile _type *p, *s;							\
-	_type *end = (_type*)p_data->buf_end;					\
-	int step = p_data->stride / sizeof(_type);
+	_type *buf, *src, *end;							\
+	int step = p_data->stride / sizeof(_type);				\
+	int offset, size;							\
+	membw_slice(p_data, p_stat, &offset, &size);				\
+	buf = (_type*)((char*)p_data->buf + offset);				\
+	src = (_type*)((char*)p_data->src + offset);				\
+	end = (_type*)((char*)p_data->buf + offset + size);
 
 #define MEMBW_CP_WORKLOAD(_type)						\
 	step = step < 1 ? 1 : step;						\
 	perf_stat_begin(p_stat);						\
 	for (int i = 0; i < p_data->iterations; i++)				\
-		for (p = (_type*)p_data->buf, s = (_type*)p_data->src;		\
+		for (p = buf, s = src;						\
 		     p < end; p += step, s += step)				\
 			*p = *s;						\
 	perf_stat_end(p_stat);							\
 	print_bandwidth(sizeof(*p) * 8, step * sizeof(*p), 			\
-		p_data->buf_size, p_data->iterations, p_stat, 1);
+		size, p_data->iterations, p_stat, 1);
 
 #define MEMBW_CP_WORKLOAD_4X(_type)						\
 	step = step < 4 ? 4 : step;						\
 	perf_stat_begin(p_stat);						\
 	for (int i = 0; i < p_data->iterations; i++) {				\
-		for (p = (_type*)p_data->buf, s = (_type*)p_data->src;		\
+		for (p = buf, s = src;						\
 		     p < end; p += step, s += step) {				\
 			*p = *s;						\
 			*(p + 1) = *(s + 1);					\
@@ -280,7 +318,7 @@ static void membw_wr_8_4x(struct perf_case *p_case, struct perf_stat *p_stat)
 	}									\
 	perf_stat_end(p_stat);							\
 	print_bandwidth(sizeof(*p) * 8, step * sizeof(*p), 			\
-		p_data->buf_size, p_data->iterations, p_stat, 4);
+		size, p_data->iterations, p_stat, 4);
 
 static void membw_cp_1(struct perf_case *p_case, struct perf_stat *p_stat)
 {
@@ -324,13 +362,17 @@ static void membw_cp_8_4x(struct perf_case *p_case, struct perf_stat *p_stat)
 		.desc = _desc,							\
 		.init = membw_init,						\
 		.exit = membw_exit,						\
+		.get_iterations = membw_get_iterations,				\
+		.set_iterations = membw_set_iterations,				\
+		.reset_opts = membw_reset_opts,					\
 		.func = _name,							\
 		.getopt = membw_getopt,						\
 		.opts = membw_opts,						\
 		.opts_num = sizeof(membw_opts) / sizeof(struct perf_option),	\
 		.events = membw_events,						\
 		.event_num = sizeof(membw_events) / sizeof(struct perf_event),	\
-		.inner_stat = true						\
+		.inner_stat = true,						\
+		.threaded = true						\
 	};
 
 DEFINE_MEMBW_CASE(membw_rd_1,    "read a memory buffer. (8bit)");
@@ -12,6 +12,7 @@
 struct memlat_data {
 	char **buf;
 	int buf_size;
+	int slice_size;
 	int iterations;
 };
 
@@ -43,6 +44,12 @@ static int memlat_getopt(struct perf_case* p_case, int opt)
 	return SUCCESS;
 }
 
+static void memlat_reset_opts(struct perf_case *p_case)
+{
+	opt_buf_size = BUF_SIZE;
+	opt_iterations = 1;
+}
+
 static void init_random_buf(char **buf, int buf_size)
 {
 	int num = buf_size / sizeof(char*);
@@ -78,7 +85,10 @@ static int memlat_init(struct perf_case *p_case, struct perf_stat *p_stat, int a
 	if (!p_data->buf)
 		goto ERR_EXIT_1;
 
-	init_random_buf(p_data->buf, p_data->buf_size);
+	/* Each thread chases pointers in its own slice of the buffer. */
+	p_data->slice_size = p_data->buf_size / p_stat->thread_num / (sizeof(char*) * 128) * (sizeof(char*) * 128);
+	for (int i = 0; i < p_stat->thread_num; i++)
+		init_random_buf(p_data->buf + i * p_data->slice_size / sizeof(char*), p_data->slice_size);
 
 	return SUCCESS;
 
@@ -97,6 +107,18 @@ static int memlat_exit(struct perf_case *p_case, struct perf_stat *p_stat)
 	return SUCCESS;
 }
 
+static int memlat_get_iterations(struct perf_case *p_case)
+{
+	struct memlat_data *p_data = (struct memlat_data*)p_case->data;
+	return p_data->iterations;
+}
+
+static void memlat_set_iterations(struct perf_case *p_case, int iterations)
+{
+	struct memlat_data *p_data = (struct memlat_data*)p_case->data;
+	p_data->iterations = iterations;
+}
+
 static void print_latency(int buf_size, int count, int iterations, struct perf_stat *p_stat)
 {
 	double size_mb = (double)buf_size / 1024 / 1024;
@@ -105,6 +127,8 @@ static void print_latency(int buf_size, int count, int iterations, struct perf_s
 	printf("iterations: %d\n", iterations);
 	printf("total ops: %d\n", count);
 	printf("latency: %.3f ns\n", latency_ns);
+	perf_stat_add_metric(p_stat, "latency", "ns", latency_ns);
+	perf_stat_add_metric(p_stat, "ops", "ops", count);
 }
 
 #define	DO_1	p = (char **)*p;
@@ -121,10 +145,11 @@ void use_pointer(void *pointer)
 static void memlat_func(struct perf_case *p_case, struct perf_stat *p_stat)
 {
 	struct memlat_data *p_data = (struct memlat_data*)p_case->data;
-	register char **p = (char**)p_data->buf[0];
+	char **slice = p_data->buf + p_stat->thread_id * p_data->slice_size / sizeof(char*);
+	register char **p = (char**)slice[0];
 	register int iterations = p_data->iterations;
 	register int i;
-	register int round = p_data->buf_size / (sizeof(char*) * 128);
+	register int round = p_data->slice_size / (sizeof(char*) * 128);
 
 	perf_stat_begin(p_stat);
 	while (iterations-- > 0) {
@@ -135,7 +160,7 @@ static void memlat_func(struct perf_case *p_case, struct perf_stat *p_stat)
 	perf_stat_end(p_stat);
 
 	use_pointer(p); // to avoid compiler optimization
-	print_latency(p_data->buf_size, 128 * round * p_data->iterations, p_data->iterations, p_stat);
+	print_latency(p_data->slice_size, 128 * round * p_data->iterations, p_data->iterations, p_stat);
 }
 
 PERF_CASE_DEFINE(memlat_random) = {
@@ -143,11 +168,15 @@ PERF_CASE_DEFINE(memlat_random) = {
 	.desc = "memory random access latnecy.",
 	.init = memlat_init,
 	.exit = memlat_exit,
+	.get_iterations = memlat_get_iterations,
+	.set_iterations = memlat_set_iterations,
+	.reset_opts = memlat_reset_opts,
 	.func = memlat_func,
 	.getopt = memlat_getopt,
 	.opts = memlat_opts,
 	.opts_num = sizeof(memlat_opts) / sizeof(struct perf_option),
 	.events = memlat_events,
 	.event_num = sizeof(memlat_events) / sizeof(struct perf_event),
-	.inner_stat = true
+	.inner_stat = true,
+	.threaded = true
 };
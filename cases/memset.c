@@ -30,6 +30,13 @@ static int memset_malloc_exit(struct perf_case *p_case, struct perf_stat *p_stat
 	return SUCCESS;
 }
 
+// Page faults are part of the measurement, give each run fresh pages.
+static int memset_malloc_reset(struct perf_case *p_case, struct perf_stat *p_stat)
+{
+	memset_malloc_exit(p_case, p_stat);
+	return memset_malloc_init(p_case, p_stat, 0, NULL);
+}
+
 static void memset_malloc_func(struct perf_case *p_case, struct perf_stat *p_stat)
 {
 	memset(p_case->data, 0xFF, DYNAMIC_BUF_SIZE);
@@ -40,6 +47,7 @@ PERF_CASE_DEFINE(memset_malloc) = {
 	.desc = "memset a malloc buffer. (128MB)",
 	.init = memset_malloc_init,
 	.exit = memset_malloc_exit,
+	.reset = memset_malloc_reset,
 	.func = memset_malloc_func,
 	.events = memset_events,
 	.event_num = sizeof(memset_events) / sizeof(struct perf_event)
@@ -58,6 +66,7 @@ PERF_CASE_DEFINE(memset_malloc_x2) = {
 	.desc = "memset a malloc buffer again. (128MB)",
 	.init = memset_malloc_init,
 	.exit = memset_malloc_exit,
+	.reset = memset_malloc_reset,
 	.func = memset_malloc_func_x2,
 	.events = memset_events,
 	.event_num = sizeof(memset_events) / sizeof(struct perf_event),
@@ -79,6 +88,12 @@ static int memset_mmap_exit(struct perf_case *p_case, struct perf_stat *p_stat)
 	return SUCCESS;
 }
 
+static int memset_mmap_reset(struct perf_case *p_case, struct perf_stat *p_stat)
+{
+	memset_mmap_exit(p_case, p_stat);
+	return memset_mmap_init(p_case, p_stat, 0, NULL);
+}
+
 static void memset_mmap_func(struct perf_case *p_case, struct perf_stat *p_stat)
 {
 	memset(p_case->data, 0xFF, DYNAMIC_BUF_SIZE);
@@ -89,6 +104,7 @@ PERF_CASE_DEFINE(memset_mmap) = {
 	.desc = "memset a mmap buffer. (128MB)",
 	.init = memset_mmap_init,
 	.exit = memset_mmap_exit,
+	.reset = memset_mmap_reset,
 	.func = memset_mmap_func,
 	.events = memset_events,
 	.event_num = sizeof(memset_events) / sizeof(struct perf_event)
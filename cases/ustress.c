@@ -27,6 +27,11 @@ static int ustress_getopt(struct perf_case* p_case, int opt)
 	return SUCCESS;
 }
 
+static void ustress_reset_opts(struct perf_case *p_case)
+{
+	opt_iterations = 0;
+}
+
 static int ustress_init(struct perf_case *p_case, struct perf_stat *p_stat, int argc, char *argv[])
 {
 	struct ustress_data *p_data;
@@ -47,10 +52,22 @@ static int ustress_exit(struct perf_case *p_case, struct perf_stat *p_stat)
 	return SUCCESS;
 }
 
+static void ustress_set_iterations(struct perf_case *p_case, int iterations)
+{
+	struct ustress_data *p_data = (struct ustress_data*)p_case->data;
+	p_data->iterations = iterations;
+}
+
 #define DEFINE_USTRESS_CASE(_name, _runs)						\
 											\
 extern void ustress_##_name(long runs);							\
 											\
+static int ustress_##_name##_get_iterations(struct perf_case *p_case)			\
+{											\
+	struct ustress_data *p_data = (struct ustress_data*)p_case->data;		\
+	return p_data->iterations > 0 ? p_data->iterations : _runs;			\
+}											\
+											\
 static void ustress_##_name##_func(struct perf_case *p_case, struct perf_stat *p_stat)	\
 {											\
 	struct ustress_data *p_data = (struct ustress_data*)p_case->data;		\
@@ -59,6 +76,7 @@ static void ustress_##_name##_func(struct perf_case *p_case, struct perf_stat *p
 	perf_stat_begin(p_stat);							\
 	ustress_##_name(iterations);							\
 	perf_stat_end(p_stat);								\
+	perf_stat_add_metric(p_stat, "runs", "ops", iterations);			\
 }											\
 											\
 PERF_CASE_DEFINE(ustress_##_name) = {							\
@@ -66,6 +84,9 @@ PERF_CASE_DEFINE(ustress_##_name) = {							\
 	.desc = "ARM ustress/" # _name "_workload",					\
 	.init = ustress_init,								\
 	.exit = ustress_exit,								\
+	.get_iterations = ustress_##_name##_get_iterations,				\
+	.set_iterations = ustress_set_iterations,					\
+	.reset_opts = ustress_reset_opts,						\
 	.func = ustress_##_name##_func,							\
 	.getopt = ustress_getopt,							\
 	.opts = ustress_opts,								\
@@ -5,19 +5,68 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <math.h>
+#include <limits.h>
 #include <sched.h>
+#include <fcntl.h>
+#include <fnmatch.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <pthread.h>
 #include "perf_case.h"
 #include "perf_stat.h"
+#include "perf_summary.h"
+#include "perf_symbol.h"
+#include "perf_cpu.h"
+#include "perf_sched.h"
+#include "perf_pmu.h"
 #include "arch/arm_pmuv3.h"
 
 static struct perf_option default_options[] = {
 	{{"help",   optional_argument, NULL, 'h' }, "h",  "Help."},
-	{{"cpu",    optional_argument, NULL, 'c' }, "c:", "Choose a CPU to run."},
-	{{"events", optional_argument, NULL, 'e' }, "e:", "Run case with events. (case|default|armv8|orin)."},
+	{{"cpu",    optional_argument, NULL, 'c' }, "c:", "Choose CPUs to run, one after another. (e.g. 2, 0-3,6, all)"},
+	{{"events", optional_argument, NULL, 'e' }, "e:", "Run case with events. (case|default|armv8|orin|topdown|file:<path>|pmu:<pmu>)"},
+	{{"multiplex", no_argument,     NULL, 'm' }, "m",  "Collect all events in one run with kernel multiplexing."},
+	{{"repeat", optional_argument, NULL, 'r' }, "r:", "Measured runs per event group. (default: 1)"},
+	{{"warmup", optional_argument, NULL, 'w' }, "w:", "Unmeasured runs per event group before measuring."},
+	{{"overhead", no_argument,      NULL, 'O' }, "O",  "Calibrate and report the measurement overhead."},
+	{{"subtract-overhead", no_argument, NULL, 'X' }, "X", "Subtract the calibrated overhead from results."},
+	{{"min-time", optional_argument, NULL, 'M' }, "M:", "Scale case iterations until a run takes this long. (ms)"},
+	{{"output", optional_argument, NULL, 'o' }, "o:", "Write the report to a file. (a directory with --suite)"},
+	{{"format", optional_argument, NULL, 'f' }, "f:", "Report format. (text|json|csv, default: text)"},
+	{{"sample", optional_argument, NULL, 'S' }, "S:", "Sample the measured region on an event. (event name)"},
+	{{"period", optional_argument, NULL, 'P' }, "P:", "Events between two samples. (default: 100000)"},
+	{{"interval", optional_argument, NULL, 'I' }, "I:", "Record counts every interval during a run. (us)"},
+	{{"threads", optional_argument, NULL, 't' }, "t:", "Run the case on threads, one per CPU from -c. (default: 1)"},
+	{{"split-priv", no_argument,    NULL, 'U' }, "U",  "Count every event in user and kernel space separately."},
 };
 
+#define CALIBRATE_LOOPS		200
+#define SAMPLE_PERIOD		100000
+#define SAMPLE_TOP_ADDRS	20
+#define HELP			1	/* init_opts() printed the help, nothing to run */
+
 static struct perf_eventset *g_eventset = NULL;
+static struct perf_eventset *g_loaded_eventset = NULL;
+static int g_multiplex = 0;
+static int g_repeat = 1;
+static int g_warmup = 0;
+static int g_calibrate = 0;
+static int g_subtract = 0;
+static long g_min_time = 0;
+static char *g_output = NULL;
+static int g_output_append = 0;
+static int g_format = PERF_FORMAT_TEXT;
+static char g_params[PARAMS_LEN];
+static int g_stdout_header = 0;
+static char *g_sample = NULL;
+static uint64_t g_period = SAMPLE_PERIOD;
+static long g_interval = 0;
+static int g_cpus[MAX_CPUS];
+static int g_cpu_num = 1;
+static int g_cpu_given = 0;
+static int g_threads = 1;
+static int g_split_priv = 0;
 
 static struct perf_event default_events[] = {
 	PERF_EVENT(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cpu-cycles"),
@@ -201,7 +250,27 @@ static struct perf_event armv8_events[] = {
 	*/
 };
 
-// Orin events, only support run on CPU0
+/*
+ * Top-down level 1 and 2. The scheduler opens a group per cpu_cycles, so
+ * ratios are normalized by the cycles of the same group.
+ */
+static struct perf_event topdown_events[] = {
+	/* level 1 */
+	PERF_EVENT(PERF_TYPE_RAW, ARMV8_PMUV3_PERFCTR_CPU_CYCLES, 		"cpu_cycles"),
+	PERF_EVENT(PERF_TYPE_RAW, ARMV8_PMUV3_PERFCTR_STALL_SLOT, 		"stall_slot"),
+	PERF_EVENT(PERF_TYPE_RAW, ARMV8_PMUV3_PERFCTR_STALL_SLOT_FRONTEND, 	"stall_slot_frontend"),
+	PERF_EVENT(PERF_TYPE_RAW, ARMV8_PMUV3_PERFCTR_STALL_SLOT_BACKEND, 	"stall_slot_backend"),
+	PERF_EVENT(PERF_TYPE_RAW, ARMV8_PMUV3_PERFCTR_OP_SPEC, 			"op_spec"),
+	PERF_EVENT(PERF_TYPE_RAW, ARMV8_PMUV3_PERFCTR_OP_RETIRED, 		"op_retired"),
+
+	/* level 2 */
+	PERF_EVENT(PERF_TYPE_RAW, ARMV8_PMUV3_PERFCTR_CPU_CYCLES, 		"cpu_cycles"),
+	PERF_EVENT(PERF_TYPE_RAW, ARMV8_PMUV3_PERFCTR_BR_MIS_PRED, 		"br_mis_pred"),
+	PERF_EVENT(PERF_TYPE_RAW, ARMV8_PMUV3_PERFCTR_STALL_BACKEND, 		"stall_backend"),
+	PERF_EVENT(PERF_TYPE_RAW, ARMV8_AMU_PERFCTR_STALL_BACKEND_MEM, 		"stall_backend_mem"),
+};
+
+// Orin events, the scf_pmu uncore counts system-wide on the CPU of its cpumask
 static struct perf_event orin_events[] = {
 	PERF_RAW_EVENT("scf_pmu/bus_cycles", 			"scf_bus_cycles"),
 	PERF_RAW_EVENT("scf_pmu/bus_access", 			"scf_bus_access"),
@@ -221,6 +290,7 @@ static struct perf_eventset perf_event_sets[] = {
 	PERF_EVENT_SET("default", default_events),
 	PERF_EVENT_SET("armv8", armv8_events),
 	PERF_EVENT_SET("orin", orin_events),
+	PERF_EVENT_SET("topdown", topdown_events),
 };
 
 static struct perf_case *perf_cases[] = {
@@ -281,9 +351,15 @@ static struct perf_case *perf_cases[] = {
 	PERF_CASE(ustress_store_buffer_full),
 };
 
+// Count a process instead of a case, left out of the case list and suites.
+static struct perf_case *perf_commands[] = {
+	PERF_CASE(exec),
+	PERF_CASE(attach),
+};
+
 static int g_cpu_id = -1;
 
-static void init_cpu(int cpu)
+static int init_cpu(int cpu)
 {
 	int err;
 	pid_t pid = getpid();
@@ -295,10 +371,10 @@ static void init_cpu(int cpu)
 	err = sched_setaffinity(pid, sizeof(mask), &mask);
 	if (err) {
 		printf("ERROR: Set cpu affinity failed.\n");
-		exit(0);
+		return ERROR;
 	}
 	g_cpu_id = cpu;
-	printf("Run on CPU: %d\n", cpu);
+	return SUCCESS;
 }
 
 static int get_cpu()
@@ -309,11 +385,16 @@ static int get_cpu()
 struct perf_case* perf_case_find(char* name)
 {
 	int case_num = sizeof(perf_cases) / sizeof(struct perf_case*);
+	int cmd_num = sizeof(perf_commands) / sizeof(struct perf_case*);
 
 	for (int i = 0; i < case_num; i++)
 		if (!strcmp(name, perf_cases[i]->name))
 			return perf_cases[i];
 
+	for (int i = 0; i < cmd_num; i++)
+		if (!strcmp(name, perf_commands[i]->name))
+			return perf_commands[i];
+
 	return NULL;
 }
 
@@ -328,11 +409,79 @@ struct perf_eventset* perf_eventset_find(char* name)
 	return NULL;
 }
 
-struct perf_run* perf_case_create_run(struct perf_case *p_case)
+// Find an event of the built-in event sets by name.
+struct perf_event* perf_event_find(const char *name)
+{
+	int set_num = sizeof(perf_event_sets) / sizeof(struct perf_eventset);
+
+	for (int i = 0; i < set_num; i++)
+		for (int j = 0; j < perf_event_sets[i].event_num; j++)
+			if (perf_event_sets[i].events[j].event_name && !strcmp(name, perf_event_sets[i].events[j].event_name))
+				return &perf_event_sets[i].events[j];
+
+	return NULL;
+}
+
+// Find a sampling event by name, in the events of the run first, then in all event sets.
+static struct perf_event* find_sample_event(char *name, struct perf_event *events, int event_num)
+{
+	for (int i = 0; i < event_num; i++)
+		if (events[i].event_name && !strcmp(name, events[i].event_name))
+			return &events[i];
+
+	return perf_event_find(name);
+}
+
+/*
+ * Replace every event by a user and a kernel only copy, named "<event>:u"
+ * and "<event>:k". Events with a modifier, uncore events, which can not
+ * tell user from kernel, and software events, counted in the mode the task
+ * was in (a page fault is always :u), are kept as they are.
+ */
+static void split_priv(struct perf_run *p_run, struct perf_event *events, int event_num)
+{
+	struct perf_event *event, source;
+	char name[EVENT_NAME_LEN * 2];
+	const char *base;
+
+	p_run->split_events = calloc(event_num * 2, sizeof(struct perf_event));
+
+	for (int i = 0; i < event_num; i++) {
+		// Resolve a copy to know if it is uncore, the run reports failures.
+		source = events[i];
+		if (source.event_path)
+			perf_pmu_resolve(source.event_path, &source);
+		base = source.event_name ? source.event_name : strchr(source.event_path, '/') + 1;
+
+		for (int priv = PERF_PRIV_USER; priv <= PERF_PRIV_KERNEL; priv++) {
+			event = &p_run->split_events[p_run->split_num++];
+			*event = source;
+			if (source.priv != PERF_PRIV_ALL || source.system_wide ||	\
+			    source.type == PERF_TYPE_SOFTWARE) {
+				event->event_name = strdup(base);
+				break;
+			}
+			snprintf(name, sizeof(name), "%s:%c", base, priv == PERF_PRIV_USER ? 'u' : 'k');
+			event->event_name = strdup(name);
+			event->priv = priv;
+		}
+	}
+}
+
+static void free_split(struct perf_run *p_run)
+{
+	for (int i = 0; i < p_run->split_num; i++)
+		free(p_run->split_events[i].event_name);
+	free(p_run->split_events);
+}
+
+// Threads share the packing, only the first one prints it (verbose).
+struct perf_run* perf_case_create_run(struct perf_case *p_case, int cpu, int verbose)
 {
 	struct perf_run *p_run;
-	struct perf_event *events;
-	int event_num, stat_num, err;
+	struct perf_event *events, *sample_event, *filtered;
+	struct perf_sched_caps caps;
+	int event_num, stat_num, err, *sizes;
 
 	if (!p_case)
 		return NULL;
@@ -351,90 +500,850 @@ struct perf_run* perf_case_create_run(struct perf_case *p_case)
 		event_num = sizeof(default_events) / sizeof(struct perf_event);
 	}
 
-	stat_num = ceill((float)event_num / (float)MAX_PERF_EVENTS);
-	p_run->stats = malloc(sizeof(struct perf_stat) * stat_num);
-	p_run->stat_num = stat_num;
-	p_run->p_case = p_case;
+	if (g_split_priv) {
+		split_priv(p_run, events, event_num);
+		events = p_run->split_events;
+		event_num = p_run->split_num;
+	}
 
-	for (int i = 0; i < stat_num; i++) {
-		err = perf_stat_init(									\
-			&p_run->stats[i], p_case->name,							\
-			events + MAX_PERF_EVENTS * i, 							\
-			(i == stat_num - 1) ? (event_num - MAX_PERF_EVENTS * i) : MAX_PERF_EVENTS,	\
-			get_cpu()									\
-		);
+	if (g_multiplex && event_num > MAX_STAT_EVENTS) {
+		printf("ERROR: Too many events to multiplex. (max: %d)\n", MAX_STAT_EVENTS);
+		free_split(p_run);
+		free(p_run);
+		return NULL;
+	}
+
+	p_run->p_case = p_case;
+	p_run->cpu = cpu;
+	p_run->eventset = g_eventset ? g_eventset->name : (p_case->events ? "case" : "default");
+	snprintf(p_run->params, PARAMS_LEN, "%s", g_params);
+	p_run->repeat = g_repeat;
+	p_run->warmup = g_warmup;
+	p_run->calibrate = g_calibrate || g_subtract;
+	p_run->subtract = g_subtract;
+	p_run->min_time = g_min_time;
+	p_run->interval = g_interval;
+
+	// Events the CPU can not count are kept after the others to be reported, never scheduled.
+	p_run->events = malloc(sizeof(struct perf_event) * event_num);
+	p_run->event_status = malloc(sizeof(int) * event_num);
+	p_run->event_num = event_num;
+	filtered = malloc(sizeof(struct perf_event) * event_num);
+	p_run->supported_num = perf_sched_filter(events, event_num, cpu, filtered, p_run->event_status);
+
+	if (verbose && p_run->supported_num < event_num)
+		printf("Unsupported: %d of %d events\n", event_num - p_run->supported_num, event_num);
+
+	// Multiplexed runs put every event in one stat and let the kernel rotate them.
+	if (g_multiplex) {
+		memcpy(p_run->events, filtered, sizeof(struct perf_event) * event_num);
+		free(filtered);
+		p_run->stats = malloc(sizeof(struct perf_stat));
+		err = perf_stat_init_multiplex(&p_run->stats[0], p_case->name, p_run->events, p_run->supported_num, cpu);
 		if (err)
 			goto ERR_EXIT;
+		p_run->stat_num = 1;
+		goto ALLOC_RESULTS;
+	}
+
+	// Every group is a separate run of the case, pack them as tight as the PMU allows.
+	sizes = malloc(sizeof(int) * (event_num + 1));
+	stat_num = perf_sched_pack(filtered, p_run->supported_num, cpu, p_run->events, sizes);
+	memcpy(p_run->events + p_run->supported_num, filtered + p_run->supported_num,	\
+		sizeof(struct perf_event) * (event_num - p_run->supported_num));
+	free(filtered);
+
+	// The case still runs once when nothing can be counted.
+	if (!stat_num)
+		sizes[stat_num++] = 0;
+	p_run->stats = malloc(sizeof(struct perf_stat) * stat_num);
+
+	if (verbose) {
+		if (perf_sched_probe(cpu, &caps))
+			printf("Groups: %d for %d events (PMU not probed, %d per group)\n", stat_num, p_run->supported_num, caps.counters);
+		else
+			printf("Groups: %d for %d events (%d counters%s)\n", stat_num, p_run->supported_num,	\
+				caps.counters, caps.fixed_cycles ? " + cycle counter" : "");
+	}
+
+	for (int i = 0, offset = 0; i < stat_num; offset += sizes[i++]) {
+		err = perf_stat_init(&p_run->stats[i], p_case->name, p_run->events + offset, sizes[i], cpu);
+		if (err) {
+			free(sizes);
+			goto ERR_EXIT;
+		}
+		p_run->stat_num++;
+	}
+	free(sizes);
+
+ALLOC_RESULTS:
+	// Sampling once is enough, it runs with the first group.
+	if (g_sample) {
+		sample_event = find_sample_event(g_sample, events, event_num);
+		if (!sample_event)
+			printf("WARNING: No event named \"%s\" to sample.\n", g_sample);
+		else if (perf_stat_sample(&p_run->stats[0], sample_event, g_period))
+			printf("WARNING: Can not sample on %s.\n", g_sample);
+	}
+
+	p_run->results = calloc(p_run->stat_num, sizeof(struct perf_result));
+	for (int i = 0; i < p_run->stat_num; i++) {
+		p_run->results[i].durations = calloc(p_run->repeat, sizeof(long));
+		p_run->results[i].counts = calloc(p_run->repeat * p_run->stats[i].event_num, sizeof(uint64_t));
+		p_run->results[i].metrics = calloc(p_run->repeat * MAX_STAT_METRICS, sizeof(struct perf_metric));
+		if (!g_interval)
+			continue;
+		if (perf_stat_set_interval(&p_run->stats[i], g_interval)) {
+			printf("WARNING: Can not record counts of group %d every %ld us.\n", i, g_interval);
+			continue;
+		}
+		p_run->results[i].series_times = calloc(p_run->repeat, sizeof(long*));
+		p_run->results[i].series_counts = calloc(p_run->repeat, sizeof(uint64_t*));
+		p_run->results[i].series_num = calloc(p_run->repeat, sizeof(int));
 	}
 
 	return p_run;
 
 ERR_EXIT:
+	for (int i = 0; i < p_run->stat_num; i++)
+		perf_stat_destroy(&p_run->stats[i]);
 	free(p_run->stats);
+	free(p_run->events);
+	free(p_run->event_status);
+	free_split(p_run);
 	free(p_run);
 	return NULL;
 }
 
 void perf_case_destroy_run(struct perf_run *p_run)
 {
+	for (int i = 0; i < p_run->stat_num; i++) {
+		perf_stat_destroy(&p_run->stats[i]);
+		free(p_run->results[i].durations);
+		free(p_run->results[i].counts);
+		free(p_run->results[i].metrics);
+		if (!p_run->results[i].series_num)
+			continue;
+		for (int r = 0; r < p_run->repeat; r++) {
+			free(p_run->results[i].series_times[r]);
+			free(p_run->results[i].series_counts[r]);
+		}
+		free(p_run->results[i].series_times);
+		free(p_run->results[i].series_counts);
+		free(p_run->results[i].series_num);
+	}
+	free(p_run->results);
 	free(p_run->stats);
+	free(p_run->events);
+	free(p_run->event_status);
+	free_split(p_run);
 	free(p_run);
 }
 
-int perf_case_run(struct perf_run* p_run, int argc, char **argv)
+// Keep the interval series of repeat r, the stat reuses its buffer next run.
+static void perf_case_save_series(struct perf_result *p_result, struct perf_stat *p_stat, int r)
 {
-	struct perf_case *p_case;
+	struct perf_series *series = p_stat->series;
+
+	p_result->series_num[r] = series->num;
+	p_result->series_times[r] = malloc(sizeof(long) * series->num);
+	p_result->series_counts[r] = malloc(sizeof(uint64_t) * series->num * p_stat->event_num);
+	memcpy(p_result->series_times[r], series->times, sizeof(long) * series->num);
+	memcpy(p_result->series_counts[r], series->counts, sizeof(uint64_t) * series->num * p_stat->event_num);
+}
+
+// Threads of a multi-threaded run meet at the barrier before every run.
+struct perf_sync {
+	pthread_barrier_t barrier;
+	int err;
+};
+
+static void sync_wait(struct perf_sync *sync)
+{
+	if (sync)
+		pthread_barrier_wait(&sync->barrier);
+}
+
+/*
+ * The first run finds the fixture as init left it, later runs get it back
+ * from reset. The fixture is shared, the first thread resets it for all.
+ */
+static int perf_case_reset(struct perf_run *p_run, struct perf_stat *p_stat, struct perf_sync *sync)
+{
+	struct perf_case *p_case = p_run->p_case;
+
+	if (!p_case->reset || !p_run->runs++)
+		return SUCCESS;
+
+	if (!sync)
+		return p_case->reset(p_case, p_stat);
+
+	sync_wait(sync);
+	if (!p_stat->thread_id)
+		sync->err |= p_case->reset(p_case, p_stat);
+	sync_wait(sync);
+
+	return sync->err ? ERROR : SUCCESS;
+}
+
+static void perf_case_run_once(struct perf_case *p_case, struct perf_stat *p_stat)
+{
+	if (!p_case->inner_stat)
+		perf_stat_begin(p_stat);
+
+	p_case->func(p_case, p_stat);
+
+	if (!p_case->inner_stat)
+		perf_stat_end(p_stat);
+}
+
+/*
+ * Grow the iteration count of a case until one run is at least min_time
+ * long. Tiny probes are scaled by 10x, closer ones straight to the target
+ * with some headroom, so only a few probe runs are needed.
+ */
+static int perf_case_scale_iterations(struct perf_run *p_run, struct perf_stat *p_stat)
+{
+	struct perf_case *p_case = p_run->p_case;
+	double factor, iterations;
+
+	// Warn once, the later groups run unscaled too.
+	if (!p_case->get_iterations || !p_case->set_iterations) {
+		printf("WARNING: %s has no iterations to scale, --min-time ignored.\n", p_case->name);
+		p_run->min_time = 0;
+		return ERROR;
+	}
+
+	iterations = p_case->get_iterations(p_case);
+	if (iterations < 1)
+		iterations = 1;
+
+	while (1) {
+		p_case->set_iterations(p_case, (int)iterations);
+		if (perf_case_reset(p_run, p_stat, NULL))
+			return ERROR;
+		perf_case_run_once(p_case, p_stat);
+
+		if (p_stat->duration >= p_run->min_time || iterations >= INT_MAX)
+			break;
+
+		if (p_stat->duration * 100 < p_run->min_time)
+			factor = 10;
+		else
+			factor = (double)p_run->min_time / p_stat->duration * 1.1;
+
+		iterations = ceil(iterations * factor);
+		if (iterations > INT_MAX)
+			iterations = INT_MAX;
+	}
+
+	p_run->iterations = (int)iterations;
+	printf("iterations scaled to %d for min time %.3f ms\n",	\
+		p_run->iterations, (double)p_run->min_time / 1000000);
+
+	return SUCCESS;
+}
+
+// Run every event group of a run, sync is NULL for a single-threaded run.
+static int perf_case_run_groups(struct perf_run *p_run, struct perf_sync *sync)
+{
+	struct perf_case *p_case = p_run->p_case;
 	struct perf_stat *p_stat;
+	struct perf_result *p_result;
 	long total_dur = 0;
 	int err;
 
-	p_case = p_run->p_case;
+	if (p_run->calibrate)
+		for (int i = 0; i < p_run->stat_num; i++)
+			perf_stat_calibrate(&p_run->stats[i], CALIBRATE_LOOPS);
 
 	for (int i = 0; i < p_run->stat_num; i++) {
 
 		p_stat = &p_run->stats[i];
+		p_result = &p_run->results[i];
 
-		if (p_case->init) {
-			err = p_case->init(p_case, p_stat, argc, argv);
+		/* A thread that failed to start fails all. */
+		if (sync) {
+			sync_wait(sync);
+			err = sync->err;
+			sync_wait(sync);
 			if (err)
 				return ERROR;
 		}
 
-		if (!p_case->inner_stat)
-			perf_stat_begin(&p_run->stats[i]);
+		/* Probe once, later groups reuse the scaled count. */
+		if (p_run->min_time) {
+			if (!p_run->iterations)
+				perf_case_scale_iterations(p_run, p_stat);
+			else
+				p_case->set_iterations(p_case, p_run->iterations);
+		}
 
-		p_case->func(p_case, p_stat);
+		for (int r = 0; r < p_run->warmup; r++) {
+			if (perf_case_reset(p_run, p_stat, sync))
+				return ERROR;
+			sync_wait(sync);
+			perf_case_run_once(p_case, p_stat);
+		}
 
-		if (!p_case->inner_stat)
-			perf_stat_end(&p_run->stats[i]);
+		perf_stat_reset_samples(p_stat);
 
-		if (p_case->exit) {
-			err = p_case->exit(p_case, p_stat);
-			if (err)
+		for (int r = 0; r < p_run->repeat; r++) {
+			if (perf_case_reset(p_run, p_stat, sync))
 				return ERROR;
+			sync_wait(sync);
+			perf_case_run_once(p_case, p_stat);
+
+			p_result->durations[r] = p_stat->duration;
+			memcpy(&p_result->counts[r * p_stat->event_num], p_stat->event_counts,	\
+				sizeof(uint64_t) * p_stat->event_num);
+			memcpy(&p_result->metrics[r * MAX_STAT_METRICS], p_stat->metrics,	\
+				sizeof(struct perf_metric) * p_stat->metric_num);
+			p_result->metric_num = p_stat->metric_num;
+			if (p_stat->series)
+				perf_case_save_series(p_result, p_stat, r);
+
+			if (!p_run->min_dur || p_stat->duration < p_run->min_dur)
+				p_run->min_dur = p_stat->duration;
+			if (!p_run->max_dur || p_stat->duration > p_run->max_dur)
+				p_run->max_dur = p_stat->duration;
+			total_dur += p_stat->duration;
 		}
-
-		if (!p_run->min_dur || p_stat->duration < p_run->min_dur)
-			p_run->min_dur = p_stat->duration;
-		if (!p_run->max_dur || p_stat->duration > p_run->max_dur)
-			p_run->max_dur = p_stat->duration;
-		total_dur += p_stat->duration;
 	}
 
-	p_run->avg_dur = total_dur / p_run->stat_num;
+	p_run->avg_dur = total_dur / (p_run->stat_num * p_run->repeat);
 
 	return SUCCESS;
 }
 
+int perf_case_run(struct perf_run* p_run, int argc, char **argv)
+{
+	struct perf_case *p_case = p_run->p_case;
+	struct perf_stat *p_stat = &p_run->stats[0];
+	int err;
+
+	/*
+	 * Set up the fixture once for all event groups, so every group measures
+	 * the same buffers. Cases that need a fresh state per run (e.g. first
+	 * touch page faults) restore it in reset.
+	 */
+	if (p_case->init) {
+		err = p_case->init(p_case, p_stat, argc, argv);
+		if (err)
+			return ERROR;
+	}
+
+	err = perf_case_run_groups(p_run, NULL);
+
+	if (p_case->exit)
+		err |= p_case->exit(p_case, p_stat);
+
+	return err ? ERROR : SUCCESS;
+}
+
+struct perf_worker {
+	pthread_t thread;
+	struct perf_run *p_run;
+	struct perf_sync *sync;
+	int err;
+};
+
+static void* perf_case_worker(void *arg)
+{
+	struct perf_worker *worker = arg;
+
+	// The run was created on the main thread, count this one instead.
+	for (int i = 0; i < worker->p_run->stat_num; i++)
+		perf_stat_attach(&worker->p_run->stats[i], 0);
+
+	worker->err = perf_case_run_groups(worker->p_run, worker->sync);
+
+	return NULL;
+}
+
+/*
+ * Run a case on one thread per run, each pinned to the CPU of its run and
+ * counting with its own stats. The case is set up once with the stats of
+ * the first thread, which carry thread_num, so it can split its work.
+ */
+static int perf_case_run_threads(struct perf_run **runs, int thread_num, int argc, char **argv)
+{
+	struct perf_case *p_case = runs[0]->p_case;
+	struct perf_stat *p_stat = &runs[0]->stats[0];
+	struct perf_worker *workers;
+	struct perf_sync sync;
+	pthread_attr_t attr;
+	cpu_set_t mask;
+	int err = SUCCESS;
+
+	if (p_case->init) {
+		err = p_case->init(p_case, p_stat, argc, argv);
+		if (err)
+			return ERROR;
+	}
+
+	workers = calloc(thread_num, sizeof(struct perf_worker));
+	pthread_barrier_init(&sync.barrier, NULL, thread_num);
+	sync.err = SUCCESS;
+
+	for (int k = 0; k < thread_num; k++) {
+		workers[k].p_run = runs[k];
+		workers[k].sync = &sync;
+
+		CPU_ZERO(&mask);
+		CPU_SET(runs[k]->cpu, &mask);
+		pthread_attr_init(&attr);
+		pthread_attr_setaffinity_np(&attr, sizeof(mask), &mask);
+
+		// Every thread has to reach the barrier, a failed one only fails the run.
+		if (pthread_create(&workers[k].thread, &attr, perf_case_worker, &workers[k])) {
+			printf("ERROR: Can not start a thread on CPU %d.\n", runs[k]->cpu);
+			sync.err = ERROR;
+			pthread_create(&workers[k].thread, NULL, perf_case_worker, &workers[k]);
+		}
+		pthread_attr_destroy(&attr);
+	}
+
+	for (int k = 0; k < thread_num; k++) {
+		pthread_join(workers[k].thread, NULL);
+		err |= workers[k].err;
+	}
+
+	pthread_barrier_destroy(&sync.barrier);
+	free(workers);
+
+	if (p_case->exit)
+		err |= p_case->exit(p_case, p_stat);
+
+	return err ? ERROR : SUCCESS;
+}
+
+// Count of event j in repeat r of group i, optionally without measurement overhead.
+double perf_run_count(struct perf_run *p_run, int i, int r, int j, int corrected)
+{
+	struct perf_stat *p_stat = &p_run->stats[i];
+	uint64_t count = p_run->results[i].counts[r * p_stat->event_num + j];
+
+	if (!corrected || !p_stat->calibrated)
+		return count;
+
+	return count > p_stat->overhead_counts[j] ? count - p_stat->overhead_counts[j] : 0;
+}
+
+double perf_run_duration(struct perf_run *p_run, int i, int r, int corrected)
+{
+	struct perf_stat *p_stat = &p_run->stats[i];
+	long duration = p_run->results[i].durations[r];
+
+	if (!corrected || !p_stat->calibrated)
+		return duration;
+
+	return duration > p_stat->overhead_duration ? duration - p_stat->overhead_duration : 0;
+}
+
+static void print_summary(const char *name, double *samples, double *raw, int num, int prec)
+{
+	struct perf_summary sum;
+
+	perf_summary_calc(&sum, samples, num);
+	printf("    %-24s: %16.*f %16.1f %14.1f %7.2f%% %16.*f %16.*f %4d",	\
+		name, prec, sum.median, sum.mean, sum.stddev, sum.cv * 100,	\
+		prec, sum.p5, prec, sum.p95, sum.outliers			\
+	);
+	if (raw)
+		printf(" %16.0f", perf_summary_median(raw, num));
+	printf("\n");
+}
+
+// Metrics are computed by the case and have no overhead to subtract.
+static void print_metrics(struct perf_run *p_run, int i)
+{
+	struct perf_result *p_result = &p_run->results[i];
+	struct perf_metric *metric;
+	double *samples;
+	char name[64];
+
+	samples = malloc(sizeof(double) * p_run->repeat);
+	for (int k = 0; k < p_result->metric_num; k++) {
+		metric = &p_result->metrics[k];
+		for (int r = 0; r < p_run->repeat; r++)
+			samples[r] = p_result->metrics[r * MAX_STAT_METRICS + k].value;
+		snprintf(name, sizeof(name), "%s (%s)", metric->name, metric->unit);
+		print_summary(name, samples, NULL, p_run->repeat, 3);
+	}
+	free(samples);
+}
+
+static double median_count(struct perf_run *p_run, int i, int j, double *samples)
+{
+	for (int r = 0; r < p_run->repeat; r++)
+		samples[r] = j < 0 ? perf_run_duration(p_run, i, r, p_run->subtract) :	\
+			perf_run_count(p_run, i, r, j, p_run->subtract);
+
+	return perf_summary_median(samples, p_run->repeat);
+}
+
+// Groups differ between CPUs with different PMUs, find an event by name.
+static int find_count(struct perf_run *p_run, const char *name, double *value, double *samples)
+{
+	struct perf_stat *p_stat;
+
+	for (int i = 0; i < p_run->stat_num; i++) {
+		p_stat = &p_run->stats[i];
+		for (int j = 0; j < p_stat->event_num; j++) {
+			if (strcmp(p_stat->events[j].event_name, name))
+				continue;
+			*value = median_count(p_run, i, j, samples);
+			return SUCCESS;
+		}
+	}
+
+	return ERROR;
+}
+
+// Uncore events count the whole system, not only the case.
+static const char* event_label(struct perf_event *event, char *buf, int size)
+{
+	if (!event->system_wide)
+		return event->event_name;
+
+	snprintf(buf, size, "%s (S)", event->event_name);
+
+	return buf;
+}
+
+static void print_system_wide(struct perf_run *p_run)
+{
+	for (int j = 0; j < p_run->supported_num; j++) {
+		if (!p_run->events[j].system_wide)
+			continue;
+		printf("    (S) uncore event, counts system-wide, opened on CPU %d\n", p_run->events[j].sys_cpu);
+		return;
+	}
+}
+
+// Events that were not counted, with the reason from the probe.
+static void print_unsupported(struct perf_run *p_run)
+{
+	for (int j = p_run->supported_num; j < p_run->event_num; j++)
+		printf("    %-24s: %16s  (%s)\n", p_run->events[j].event_name,	\
+			"n/a", perf_event_status_name(p_run->event_status[j]));
+}
+
+// Report the distribution of duration and every count over the repeats.
+static void perf_case_report_repeats(struct perf_run *p_run)
+{
+	struct perf_stat *p_stat;
+	double *samples, *raw = NULL;
+	int repeat = p_run->repeat;
+	char label[64];
+
+	samples = malloc(sizeof(double) * repeat);
+	if (p_run->subtract)
+		raw = malloc(sizeof(double) * repeat);
+
+	printf("    %-24s  %16s %16s %14s %8s %16s %16s %4s",		\
+		"", "median", "mean", "stddev", "cv", "p5", "p95", "out");
+	if (raw)
+		printf(" %16s", "raw median");
+	printf("\n");
+	for (int i = 0; i < p_run->stat_num; i++) {
+		p_stat = &p_run->stats[i];
+		if (p_run->stat_num > 1)
+			printf("    [group %d]\n", i);
+		for (int r = 0; r < repeat; r++) {
+			samples[r] = perf_run_duration(p_run, i, r, p_run->subtract);
+			if (raw)
+				raw[r] = perf_run_duration(p_run, i, r, 0);
+		}
+		print_summary("time (ns)", samples, raw, repeat, 0);
+		for (int j = 0; j < p_stat->event_num; j++) {
+			for (int r = 0; r < repeat; r++) {
+				samples[r] = perf_run_count(p_run, i, r, j, p_run->subtract);
+				if (raw)
+					raw[r] = perf_run_count(p_run, i, r, j, 0);
+			}
+			print_summary(event_label(&p_stat->events[j], label, sizeof(label)), samples, raw, repeat, 0);
+		}
+		print_metrics(p_run, i);
+	}
+	print_unsupported(p_run);
+	print_system_wide(p_run);
+	printf("    (out) samples rejected as outliers by median absolute deviation\n");
+	if (raw)
+		printf("    measurement overhead subtracted, raw median before subtraction\n");
+
+	free(samples);
+	free(raw);
+}
+
+// Report the calibrated cost of an empty measurement for each group.
+static void perf_case_report_overhead(struct perf_run *p_run)
+{
+	struct perf_stat *p_stat;
+
+	printf("overhead (empty region, median of %d):\n", CALIBRATE_LOOPS);
+	for (int i = 0; i < p_run->stat_num; i++) {
+		p_stat = &p_run->stats[i];
+		if (!p_stat->calibrated)
+			continue;
+		if (p_run->stat_num > 1)
+			printf("    [group %d]\n", i);
+		printf("    %-24s: %16ld\n", "time (ns)", p_stat->overhead_duration);
+		for (int j = 0; j < p_stat->event_num; j++)
+			printf("    %-24s: %16ld\n", p_stat->events[j].event_name, p_stat->overhead_counts[j]);
+	}
+}
+
+struct sample_hist {
+	const char *name;
+	const char *module;
+	uint64_t addr;
+	uint64_t offset;
+	int count;
+};
+
+static int compare_hist(const void *a, const void *b)
+{
+	return ((const struct sample_hist*)b)->count - ((const struct sample_hist*)a)->count;
+}
+
+static int compare_ip(const void *a, const void *b)
+{
+	uint64_t x = ((const struct perf_sample*)a)->ip, y = ((const struct perf_sample*)b)->ip;
+	return x < y ? -1 : x > y;
+}
+
+static void print_hist(struct sample_hist *hist, int hist_num, int total, int addrs)
+{
+	for (int i = 0; i < hist_num; i++) {
+		printf("    %8d %6.2f%%  ", hist[i].count, 100.0 * hist[i].count / total);
+		if (addrs)
+			printf("0x%016lx  ", hist[i].addr);
+		if (!hist[i].name)
+			printf("[unknown]");
+		else if (addrs)
+			printf("%s+0x%lx", hist[i].name, hist[i].offset);
+		else
+			printf("%s", hist[i].name);
+		if (hist[i].module)
+			printf(" [%s]", hist[i].module);
+		printf("\n");
+	}
+}
+
+// Counts per interval of the first repeat, JSON and CSV keep every repeat.
+static void perf_case_report_series(struct perf_run *p_run)
+{
+	struct perf_stat *p_stat;
+	struct perf_result *p_result;
+	uint64_t *point, *prev;
+	long prev_time;
+
+	printf("-----------------------\n");
+	printf("series (every %ld us, deltas of repeat 0):\n", p_run->interval);
+	for (int i = 0; i < p_run->stat_num; i++) {
+		p_stat = &p_run->stats[i];
+		p_result = &p_run->results[i];
+		if (!p_result->series_num)
+			continue;
+		if (p_run->stat_num > 1)
+			printf("    [group %d]\n", i);
+		printf("    %12s", "time (ms)");
+		for (int j = 0; j < p_stat->event_num; j++)
+			printf(" %16.16s", p_stat->events[j].event_name);
+		printf("\n");
+
+		prev = NULL;
+		prev_time = 0;
+		for (int n = 0; n < p_result->series_num[0]; n++) {
+			point = &p_result->series_counts[0][n * p_stat->event_num];
+			printf("    %12.3f", (double)p_result->series_times[0][n] / 1000000);
+			for (int j = 0; j < p_stat->event_num; j++)
+				printf(" %16lu", !prev ? point[j] : (point[j] > prev[j] ? point[j] - prev[j] : 0));
+			printf("\n");
+			prev = point;
+			prev_time = p_result->series_times[0][n];
+		}
+		printf("    %d points over %.3f ms\n", p_result->series_num[0], (double)prev_time / 1000000);
+	}
+}
+
+// Function and address histograms of the samples taken in the measured region.
+static void perf_case_report_samples(struct perf_run *p_run)
+{
+	struct perf_stat *p_stat = &p_run->stats[0];
+	struct perf_symtab *symtab;
+	struct sample_hist *funcs, *addrs;
+	struct perf_sample *samples;
+	const char *name, *module;
+	uint64_t offset = 0;
+	pid_t pid = getpid();
+	int num = 0, func_num = 0, addr_num = 0, k;
+
+	samples = malloc(sizeof(struct perf_sample) * (p_stat->sample_num + 1));
+	for (int i = 0; i < p_stat->sample_num; i++)
+		if (p_stat->samples[i].pid == pid)
+			samples[num++] = p_stat->samples[i];
+
+	printf("-----------------------\n");
+	printf("samples: %d on %s, period %lu", num, p_stat->sample_event->event_name, p_stat->sample_period);
+	if (p_stat->sample_lost)
+		printf(", %lu lost", p_stat->sample_lost);
+	printf("\n");
+
+	if (!num) {
+		free(samples);
+		return;
+	}
+
+	symtab = perf_symtab_create();
+	funcs = calloc(num, sizeof(struct sample_hist));
+	addrs = calloc(num, sizeof(struct sample_hist));
+
+	qsort(samples, num, sizeof(struct perf_sample), compare_ip);
+
+	for (int i = 0; i < num; i++) {
+		name = perf_symtab_resolve(symtab, samples[i].ip, &offset, &module);
+
+		if (!addr_num || addrs[addr_num - 1].addr != samples[i].ip)
+			addrs[addr_num++] = (struct sample_hist){name, module, samples[i].ip, offset, 0};
+		addrs[addr_num - 1].count++;
+
+		for (k = 0; k < func_num; k++)
+			if (funcs[k].name == name && funcs[k].module == module)
+				break;
+		if (k == func_num)
+			funcs[func_num++] = (struct sample_hist){name, module, 0, 0, 0};
+		funcs[k].count++;
+	}
+
+	qsort(funcs, func_num, sizeof(struct sample_hist), compare_hist);
+	qsort(addrs, addr_num, sizeof(struct sample_hist), compare_hist);
+
+	printf("functions:\n");
+	print_hist(funcs, func_num, num, 0);
+	printf("addresses (top %d):\n", SAMPLE_TOP_ADDRS);
+	print_hist(addrs, addr_num < SAMPLE_TOP_ADDRS ? addr_num : SAMPLE_TOP_ADDRS, num, 1);
+
+	free(funcs);
+	free(addrs);
+	free(samples);
+	perf_symtab_destroy(symtab);
+}
+
+/*
+ * User and kernel counts side by side, for events counted with both ":u"
+ * and ":k" (see --split-priv).
+ */
+static void perf_case_report_priv(struct perf_run *p_run)
+{
+	struct perf_event *user, *kernel;
+	double *samples, user_count, kernel_count;
+	int len, printed = 0;
+
+	samples = malloc(sizeof(double) * p_run->repeat);
+
+	for (int j = 0; j < p_run->supported_num; j++) {
+		user = &p_run->events[j];
+		if (user->priv != PERF_PRIV_USER)
+			continue;
+		len = strlen(user->event_name);
+		if (len < 2 || strcmp(user->event_name + len - 2, ":u"))
+			continue;
+
+		kernel = NULL;
+		for (int k = 0; k < p_run->supported_num && !kernel; k++)
+			if (p_run->events[k].priv == PERF_PRIV_KERNEL &&			\
+			    !strncmp(p_run->events[k].event_name, user->event_name, len - 2) &&	\
+			    !strcmp(p_run->events[k].event_name + len - 2, ":k"))
+				kernel = &p_run->events[k];
+		if (!kernel)
+			continue;
+
+		if (find_count(p_run, user->event_name, &user_count, samples) ||	\
+		    find_count(p_run, kernel->event_name, &kernel_count, samples))
+			continue;
+
+		if (!printed++) {
+			printf("-----------------------\n");
+			printf("user / kernel%s:\n", p_run->repeat > 1 ? " (median)" : "");
+			printf("    %-24s  %16s %16s %16s %8s\n", "", "user", "kernel", "total", "kernel");
+		}
+		printf("    %-24.*s: %16.0f %16.0f %16.0f %7.2f%%\n", len - 2, user->event_name,	\
+			user_count, kernel_count, user_count + kernel_count,				\
+			user_count + kernel_count > 0 ? kernel_count * 100 / (user_count + kernel_count) : 0);
+	}
+
+	free(samples);
+}
+
 void perf_case_report_run(struct perf_run *p_run)
 {
+	struct perf_stat *p_stat;
+	char label[64];
+
+	if (p_run->calibrate) {
+		printf("-----------------------\n");
+		perf_case_report_overhead(p_run);
+	}
+
+	if (p_run->stats[0].sample_fd >= 0)
+		perf_case_report_samples(p_run);
+
+	if (p_run->interval)
+		perf_case_report_series(p_run);
+
+	if (p_run->iterations)
+		printf("iterations: %d (scaled for min time %.3f ms)\n",	\
+			p_run->iterations, (double)p_run->min_time / 1000000);
+
+	if (p_run->repeat > 1) {
+		printf("-----------------------\n");
+		perf_case_report_repeats(p_run);
+		perf_case_report_priv(p_run);
+		perf_derive_report(p_run);
+		perf_derive_topdown(p_run);
+		printf("-----------------------\n");
+		printf("finished with %d runs (%d groups x %d repeats):\n",	\
+			p_run->stat_num * p_run->repeat, p_run->stat_num, p_run->repeat);
+		printf("    min time: %f ms\n", (double)p_run->min_dur / 1000000);
+		printf("    max time: %f ms\n", (double)p_run->max_dur / 1000000);
+		printf("    avg time: %f ms\n", (double)p_run->avg_dur / 1000000);
+		return;
+	}
+
 	printf("-----------------------\n");
-	for (int i = 0; i < p_run->stat_num; i++)
-		for (int j = 0; j < p_run->stats[i].event_num; j++)
-			printf("    %-24s: %16ld\n",			\
-				p_run->stats[i].events[j].event_name,	\
-				p_run->stats[i].event_counts[j]		\
+	if (p_run->subtract)
+		printf("    %-24s  %16s %16s\n", "", "raw", "corrected");
+	for (int i = 0; i < p_run->stat_num; i++) {
+		p_stat = &p_run->stats[i];
+		for (int j = 0; j < p_stat->event_num; j++) {
+			printf("    %-24s: %16.0f",				\
+				event_label(&p_stat->events[j], label, sizeof(label)),	\
+				perf_run_count(p_run, i, 0, j, 0)	\
 			);
+			if (p_run->subtract)
+				printf(" %16.0f", perf_run_count(p_run, i, 0, j, 1));
+			/* Multiplexed counts are estimates, show how long each was counted. */
+			if (p_stat->multiplex)
+				printf("  (%6.2f%%)", perf_stat_running(p_stat, j));
+			printf("\n");
+		}
+		for (int k = 0; k < p_run->results[i].metric_num; k++)
+			printf("    %-24s: %16.3f %s\n",				\
+				p_run->results[i].metrics[k].name,		\
+				p_run->results[i].metrics[k].value,		\
+				p_run->results[i].metrics[k].unit		\
+			);
+	}
+	print_unsupported(p_run);
+	print_system_wide(p_run);
+	if (p_run->stat_num == 1 && p_run->stats[0].multiplex)
+		printf("    (%%) time counted, counts are scaled estimates\n");
+	perf_case_report_priv(p_run);
+	perf_derive_report(p_run);
+	perf_derive_topdown(p_run);
 	printf("-----------------------\n");
 	if (p_run->stat_num > 1) {
 		printf("finished with %d runs:\n", p_run->stat_num);
@@ -444,34 +1353,370 @@ void perf_case_report_run(struct perf_run *p_run)
 	} else {
 		printf("time: %f ms\n", (double)p_run->avg_dur / 1000000);
 	}
+	if (p_run->subtract)
+		printf("corrected time: %f ms\n", perf_run_duration(p_run, 0, 0, 1) / 1000000);
 }
 
-void run_case(struct perf_case *p_case, int argc, char **argv)
+// Send stdout to a file, returns the saved stdout to restore later.
+static int redirect_stdout(const char *path, int append)
 {
-	int err;
-	struct perf_run *p_run;
+	int fd, saved;
 
-	if (!p_case)
+	fflush(stdout);
+
+	fd = open(path, O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC), 0644);
+	if (fd < 0) {
+		printf("ERROR: Can not open output file: %s\n", path);
+		return ERROR;
+	}
+
+	saved = dup(STDOUT_FILENO);
+	dup2(fd, STDOUT_FILENO);
+	close(fd);
+
+	return saved;
+}
+
+static void restore_stdout(int saved)
+{
+	if (saved < 0)
 		return;
 
-	p_run = perf_case_create_run(p_case);
-	if (!p_run) {
-		printf("ERROR: Failed to create a run.\n");
-		exit(0);
+	fflush(stdout);
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+}
+
+#define CPU_COLUMN_WIDTH	14
+
+/*
+ * Side by side medians of a case run on several CPUs. CPUs of the same
+ * core PMU and cluster share a type letter, so big and little cores or
+ * clusters stand out in the table.
+ */
+static void perf_case_report_cpus(struct perf_run **runs, int run_num)
+{
+	struct perf_cpu *cpus, *type;
+	struct perf_result *p_result;
+	double *samples, value;
+	char *types, label[64];
+	int type_num = 0, k;
+
+	cpus = calloc(run_num, sizeof(struct perf_cpu));
+	types = calloc(run_num, sizeof(char));
+	samples = malloc(sizeof(double) * runs[0]->repeat);
+
+	for (int c = 0; c < run_num; c++) {
+		perf_cpu_topology(runs[c]->cpu, &cpus[c]);
+		for (k = 0; k < c; k++)
+			if (!strcmp(cpus[k].pmu, cpus[c].pmu) && cpus[k].cluster == cpus[c].cluster)
+				break;
+		types[c] = k < c ? types[k] : 'A' + type_num++;
 	}
 
-	printf("%s\n", p_case->name);
+	printf("=======================\n");
+	printf("%s on %d CPUs (median of %d repeats):\n", runs[0]->p_case->name, run_num, runs[0]->repeat);
+	printf("    %-24s ", "cpu");
+	for (int c = 0; c < run_num; c++)
+		printf(" %*d", CPU_COLUMN_WIDTH, cpus[c].id);
+	printf("\n    %-24s ", "type");
+	for (int c = 0; c < run_num; c++)
+		printf(" %*c", CPU_COLUMN_WIDTH, types[c]);
+	printf("\n-----------------------\n");
+
+	printf("    %-24s:", "time (ns)");
+	for (int c = 0; c < run_num; c++)
+		printf(" %*.0f", CPU_COLUMN_WIDTH, median_count(runs[c], 0, -1, samples));
+	printf("\n");
+
+	for (int j = 0; j < runs[0]->event_num; j++) {
+		printf("    %-24s:", event_label(&runs[0]->events[j], label, sizeof(label)));
+		for (int c = 0; c < run_num; c++) {
+			if (find_count(runs[c], runs[0]->events[j].event_name, &value, samples))
+				printf(" %*s", CPU_COLUMN_WIDTH, "n/a");
+			else
+				printf(" %*.0f", CPU_COLUMN_WIDTH, value);
+		}
+		printf("\n");
+	}
+
+	p_result = &runs[0]->results[0];
+	for (int m = 0; m < p_result->metric_num; m++) {
+		printf("    %-24s:", p_result->metrics[m].name);
+		for (int c = 0; c < run_num; c++) {
+			for (int r = 0; r < runs[c]->repeat; r++)
+				samples[r] = runs[c]->results[0].metrics[r * MAX_STAT_METRICS + m].value;
+			printf(" %*.3f", CPU_COLUMN_WIDTH, perf_summary_median(samples, runs[c]->repeat));
+		}
+		printf(" %s\n", p_result->metrics[m].unit);
+	}
+
+	print_system_wide(runs[0]);
+
 	printf("-----------------------\n");
+	printf("types:\n");
+	for (int t = 0; t < type_num; t++) {
+		for (k = 0; types[k] != 'A' + t; k++)
+			;
+		type = &cpus[k];
+		printf("    %c: pmu %s, cluster %d, capacity %d, cpus", types[k], type->pmu, type->cluster, type->capacity);
+		for (int c = k; c < run_num; c++)
+			if (types[c] == types[k])
+				printf(" %d", cpus[c].id);
+		printf("\n");
+	}
+
+	free(samples);
+	free(types);
+	free(cpus);
+}
+
+static void print_thread_row(const char *name, double *values, int num, int prec)
+{
+	double sum = 0, min = values[0], max = values[0];
+
+	printf("    %-24s:", name);
+	for (int k = 0; k < num; k++) {
+		printf(" %*.*f", CPU_COLUMN_WIDTH, prec, values[k]);
+		sum += values[k];
+		min = values[k] < min ? values[k] : min;
+		max = values[k] > max ? values[k] : max;
+	}
+	printf(" %*.*f %*.*f %*.*f %9.2f%%\n", CPU_COLUMN_WIDTH, prec, sum,	\
+		CPU_COLUMN_WIDTH, prec, min, CPU_COLUMN_WIDTH, prec, max,		\
+		sum > 0 ? (max * num / sum - 1) * 100 : 0);
+}
+
+/*
+ * Per thread medians of a multi-threaded run with their sum, min, max and
+ * imbalance (max / mean - 1). The sum of a rate metric is the aggregate.
+ */
+static void perf_case_report_threads(struct perf_run **runs, int thread_num)
+{
+	struct perf_result *p_result;
+	double *samples, *values;
+	char label[64];
+
+	samples = malloc(sizeof(double) * runs[0]->repeat);
+	values = malloc(sizeof(double) * thread_num);
+
+	printf("=======================\n");
+	printf("%s on %d threads (median of %d repeats):\n", runs[0]->p_case->name, thread_num, runs[0]->repeat);
+	printf("    %-24s ", "thread");
+	for (int k = 0; k < thread_num; k++)
+		printf(" %*d", CPU_COLUMN_WIDTH, k);
+	printf(" %*s %*s %*s %10s\n", CPU_COLUMN_WIDTH, "sum", CPU_COLUMN_WIDTH, "min",	\
+		CPU_COLUMN_WIDTH, "max", "imbalance");
+	printf("    %-24s ", "cpu");
+	for (int k = 0; k < thread_num; k++)
+		printf(" %*d", CPU_COLUMN_WIDTH, runs[k]->cpu);
+	printf("\n-----------------------\n");
+
+	for (int k = 0; k < thread_num; k++)
+		values[k] = median_count(runs[k], 0, -1, samples);
+	print_thread_row("time (ns)", values, thread_num, 0);
+
+	for (int j = 0; j < runs[0]->supported_num; j++) {
+		for (int k = 0; k < thread_num; k++)
+			if (find_count(runs[k], runs[0]->events[j].event_name, &values[k], samples))
+				values[k] = 0;
+		// Each thread's uncore counter counts the whole system, a sum would count it N times.
+		if (runs[0]->events[j].system_wide) {
+			printf("    %-24s: %*.0f\n", event_label(&runs[0]->events[j], label, sizeof(label)),	\
+				CPU_COLUMN_WIDTH, values[0]);
+			continue;
+		}
+		print_thread_row(event_label(&runs[0]->events[j], label, sizeof(label)), values, thread_num, 0);
+	}
+
+	p_result = &runs[0]->results[0];
+	for (int m = 0; m < p_result->metric_num; m++) {
+		for (int k = 0; k < thread_num; k++) {
+			for (int r = 0; r < runs[k]->repeat; r++)
+				samples[r] = runs[k]->results[0].metrics[r * MAX_STAT_METRICS + m].value;
+			values[k] = perf_summary_median(samples, runs[k]->repeat);
+		}
+		print_thread_row(p_result->metrics[m].name, values, thread_num, 3);
+	}
+
+	print_system_wide(runs[0]);
 
-	err = perf_case_run(p_run, argc, argv);
+	free(values);
+	free(samples);
+}
+
+/*
+ * Open where structured records go. Without an output file records take
+ * stdout and the text report moves to stderr, so stdout stays parsable.
+ */
+static FILE* open_records(int *saved, int *header)
+{
+	FILE *file;
+
+	if (g_output) {
+		file = fopen(g_output, g_output_append ? "a" : "w");
+		if (!file) {
+			printf("ERROR: Can not open output file: %s\n", g_output);
+			return NULL;
+		}
+		*header = !ftell(file);
+		return file;
+	}
+
+	fflush(stdout);
+	*saved = dup(STDOUT_FILENO);
+	dup2(STDERR_FILENO, STDOUT_FILENO);
+
+	*header = !g_stdout_header;
+	g_stdout_header = 1;
+
+	return fdopen(dup(*saved), "w");
+}
+
+// Run on each CPU in turn, runs are kept to tabulate the CPUs side by side.
+static int run_cpus(struct perf_case *p_case, int argc, char **argv, FILE *records, int header)
+{
+	struct perf_run *p_run, **runs;
+	int err = SUCCESS, run_num = 0, cpu;
+
+	runs = calloc(g_cpu_num, sizeof(struct perf_run*));
+
+	for (int c = 0; c < g_cpu_num; c++) {
+		err = init_cpu(g_cpus[c]);
+		if (err)
+			break;
+
+		// Another task is counted wherever it runs, unless CPUs are given.
+		cpu = p_case->any_cpu && !g_cpu_given ? -1 : get_cpu();
+		p_run = perf_case_create_run(p_case, cpu, 1);
+		if (!p_run) {
+			printf("ERROR: Failed to create a run.\n");
+			err = ERROR;
+			break;
+		}
+		runs[run_num++] = p_run;
+
+		if (c)
+			printf("=======================\n");
+		if (cpu < 0)
+			printf("Run on CPU: any\n");
+		else
+			printf("Run on CPU: %d\n", cpu);
+		printf("%s\n", p_case->name);
+		printf("-----------------------\n");
+
+		err = perf_case_run(p_run, argc, argv);
+		if (err) {
+			printf("ERROR: Case run failed.\n");
+			break;
+		}
+
+		perf_case_report_run(p_run);
+
+		if (records)
+			perf_result_write(records, p_run, g_format, header && !c);
+	}
+
+	if (!err && run_num > 1)
+		perf_case_report_cpus(runs, run_num);
+
+	for (int c = 0; c < run_num; c++)
+		perf_case_destroy_run(runs[c]);
+	free(runs);
+
+	return err;
+}
+
+// One CPU per thread from the list, or consecutive CPUs from a single one.
+static int thread_cpu(int k)
+{
+	return g_cpu_num == 1 ? g_cpus[0] + k : g_cpus[k];
+}
+
+static int run_threads(struct perf_case *p_case, int argc, char **argv, FILE *records, int header)
+{
+	struct perf_run **runs;
+	int err = SUCCESS, run_num = 0;
+
+	runs = calloc(g_threads, sizeof(struct perf_run*));
+
+	for (int k = 0; k < g_threads; k++) {
+		runs[k] = perf_case_create_run(p_case, thread_cpu(k), !k);
+		if (!runs[k]) {
+			printf("ERROR: Failed to create a run.\n");
+			err = ERROR;
+			goto EXIT;
+		}
+		run_num++;
+		// Threads run the groups in lockstep, they must have the same groups.
+		if (runs[k]->stat_num != runs[0]->stat_num) {
+			printf("ERROR: CPU %d and %d count the events in different groups.\n", thread_cpu(0), thread_cpu(k));
+			err = ERROR;
+			goto EXIT;
+		}
+		for (int i = 0; i < runs[k]->stat_num; i++) {
+			runs[k]->stats[i].thread_id = k;
+			runs[k]->stats[i].thread_num = g_threads;
+		}
+	}
+
+	printf("Run on %d threads, CPU:", g_threads);
+	for (int k = 0; k < g_threads; k++)
+		printf(" %d", thread_cpu(k));
+	printf("\n%s\n", p_case->name);
+	printf("-----------------------\n");
+
+	err = perf_case_run_threads(runs, g_threads, argc, argv);
 	if (err) {
 		printf("ERROR: Case run failed.\n");
-		exit(0);
+		goto EXIT;
+	}
+
+	for (int k = 0; k < g_threads; k++) {
+		printf("=======================\n");
+		printf("thread %d on CPU %d\n", k, runs[k]->cpu);
+		perf_case_report_run(runs[k]);
+		if (records)
+			perf_result_write(records, runs[k], g_format, header && !k);
 	}
 
-	perf_case_report_run(p_run);
+	perf_case_report_threads(runs, g_threads);
+
+EXIT:
+	for (int k = 0; k < run_num; k++)
+		perf_case_destroy_run(runs[k]);
+	free(runs);
 
-	perf_case_destroy_run(p_run);
+	return err;
+}
+
+int run_case(struct perf_case *p_case, int argc, char **argv)
+{
+	int err, saved = -1, header = 0;
+	FILE *records = NULL;
+
+	if (!p_case)
+		return ERROR;
+
+	if (g_format != PERF_FORMAT_TEXT) {
+		records = open_records(&saved, &header);
+		if (!records) {
+			restore_stdout(saved);
+			return ERROR;
+		}
+	}
+
+	if (g_threads > 1)
+		err = run_threads(p_case, argc, argv, records, header);
+	else
+		err = run_cpus(p_case, argc, argv, records, header);
+
+	if (records) {
+		fclose(records);
+		restore_stdout(saved);
+	}
+
+	return err ? ERROR : SUCCESS;
 }
 
 static void print_default_opts()
@@ -498,6 +1743,14 @@ static void print_help()
 	printf("A simple perf event test framework and some interesting testcases.\n\n");
 	printf("Usage:\n");
 	printf("    ./perf_case [case] [options]      // run a case\n");
+	printf("    ./perf_case --suite [file|glob] [options]\n");
+	printf("                                      // run a list of cases\n");
+	printf("    ./perf_case compare [A] [B] [options]\n");
+	printf("                                      // compare two csv result sets\n");
+	printf("    ./perf_case exec [options] -- [command]\n");
+	printf("                                      // count a command\n");
+	printf("    ./perf_case attach -p [pid] [options]\n");
+	printf("                                      // count a running process\n");
 	printf("    ./perf_case -h                    // help\n");
 	printf("    ./perf_case -h [case]             // help for each case\n\n");
 	printf("Options:\n");
@@ -544,24 +1797,82 @@ static void print_case_help(struct perf_case *p_case)
 	printf("\n");
 }
 
-static void init_opts(struct perf_case *p_case, int argc, char **argv)
+// Restore framework and case options before parsing a new command line.
+static void reset_opts(struct perf_case *p_case)
+{
+	g_eventset = NULL;
+	perf_eventset_free(g_loaded_eventset);
+	g_loaded_eventset = NULL;
+	g_multiplex = 0;
+	g_repeat = 1;
+	g_warmup = 0;
+	g_calibrate = 0;
+	g_subtract = 0;
+	g_min_time = 0;
+	g_output = NULL;
+	g_output_append = 0;
+	g_format = PERF_FORMAT_TEXT;
+	g_params[0] = '\0';
+	g_sample = NULL;
+	g_period = SAMPLE_PERIOD;
+	g_interval = 0;
+	g_cpus[0] = 0;
+	g_cpu_num = 1;
+	g_cpu_given = 0;
+	g_threads = 1;
+	g_split_priv = 0;
+
+	if (p_case->reset_opts)
+		p_case->reset_opts(p_case);
+}
+
+static int is_case_opt(struct perf_case *p_case, int opt)
+{
+	for (int i = 0; i < p_case->opts_num; i++)
+		if (p_case->opts[i].opt.val == opt)
+			return 1;
+
+	return 0;
+}
+
+static int parse_case_opt(struct perf_case *p_case, int opt)
+{
+	int len;
+
+	if (!p_case->getopt || p_case->getopt(p_case, opt)) {
+		printf("ERROR: Invalid parameter, please run \"./perf_case -h\" for help.\n");
+		return ERROR;
+	}
+
+	/* Keep the case options to label the results. */
+	len = strlen(g_params);
+	snprintf(g_params + len, PARAMS_LEN - len, "%s-%c%s%s",	\
+		len ? " " : "", opt, optarg ? " " : "", optarg ? optarg : "");
+
+	return SUCCESS;
+}
+
+static int init_opts(struct perf_case *p_case, int argc, char **argv)
 {
 	struct option *opts;
-	char ostr[64];
+	char *ostr;
 	int opt, opt_idx;
 	int opt_num, def_num;
-	int i, j;
-	int opt_cpu = 0;
+	int i, j, k;
 
 	def_num = sizeof(default_options) / sizeof(struct perf_option);
 	opt_num = def_num + p_case->opts_num;
 
 	opts = malloc(sizeof(struct option) * (opt_num + 1));
-
-	/* Add default options */
-	for (i = 0; i < def_num; i++) {
-		memcpy(&opts[i], &default_options[i].opt, sizeof(struct option));
-		strcat(ostr, default_options[i].ostr);
+	// Every short option is a letter with at most two colons.
+	ostr = calloc(3 * opt_num + 1, 1);
+
+	/* Add default options, a case option of the same letter hides one */
+	for (i = 0, k = 0; k < def_num; k++) {
+		if (is_case_opt(p_case, default_options[k].opt.val))
+			continue;
+		memcpy(&opts[i++], &default_options[k].opt, sizeof(struct option));
+		strcat(ostr, default_options[k].ostr);
 	}
 
 	/* Add case options */
@@ -572,41 +1883,341 @@ static void init_opts(struct perf_case *p_case, int argc, char **argv)
 
 	memset(&opts[i], 0, sizeof(struct option));
 
+	reset_opts(p_case);
+
+	/* getopt keeps state between command lines, 0 makes it start over. */
+	optind = 0;
+
 	while ((opt = getopt_long(argc, argv, ostr, opts, &opt_idx)) != -1) {
+		if (is_case_opt(p_case, opt)) {
+			if (parse_case_opt(p_case, opt))
+				goto ERR_EXIT;
+			continue;
+		}
 		switch (opt) {
 		case 'h':
 			print_case_help(p_case);
-			exit(0);
+			free(opts);
+			free(ostr);
+			return HELP;
 		case 'c':
-			opt_cpu = atoi(optarg);
+			g_cpu_num = perf_cpu_parse_list(optarg, g_cpus, MAX_CPUS);
+			if (g_cpu_num < 0) {
+				printf("ERROR: Invalid CPU list \"%s\"\n", optarg);
+				goto ERR_EXIT;
+			}
+			g_cpu_given = 1;
 			break;
 		case 'e':
 			if (!strcmp(optarg, "case"))
 				break;
-			g_eventset = perf_eventset_find(optarg);
+			if (!strncmp(optarg, "file:", 5) || !strncmp(optarg, "pmu:", 4)) {
+				perf_eventset_free(g_loaded_eventset);
+				g_eventset = g_loaded_eventset = perf_eventset_load(optarg);
+				if (!g_eventset)
+					goto ERR_EXIT;
+			} else {
+				g_eventset = perf_eventset_find(optarg);
+			}
 			if (!g_eventset) {
 				printf("ERROR: No event set named \"%s\"\n", optarg);
-				exit(0);
+				goto ERR_EXIT;
 			}
 			printf("Enable events: %s\n", g_eventset->name);
 			break;
+		case 'm':
+			g_multiplex = 1;
+			break;
+		case 'r':
+			g_repeat = atoi(optarg);
+			if (g_repeat < 1) {
+				printf("ERROR: Repeat must be at least 1.\n");
+				goto ERR_EXIT;
+			}
+			break;
+		case 'w':
+			g_warmup = atoi(optarg);
+			break;
+		case 'O':
+			g_calibrate = 1;
+			break;
+		case 'X':
+			g_subtract = 1;
+			break;
+		case 'M':
+			g_min_time = atof(optarg) * 1000000;
+			break;
+		case 'o':
+			g_output = optarg;
+			break;
+		case 'S':
+			g_sample = optarg;
+			break;
+		case 'P':
+			g_period = strtoull(optarg, NULL, 0);
+			if (!g_period) {
+				printf("ERROR: Sample period must be at least 1.\n");
+				goto ERR_EXIT;
+			}
+			break;
+		case 'I':
+			g_interval = atol(optarg);
+			if (g_interval <= 0) {
+				printf("ERROR: Interval must be at least 1 us.\n");
+				goto ERR_EXIT;
+			}
+			break;
+		case 'U':
+			g_split_priv = 1;
+			break;
+		case 't':
+			g_threads = atoi(optarg);
+			if (g_threads < 1 || g_threads > MAX_CPUS) {
+				printf("ERROR: Threads must be 1 to %d.\n", MAX_CPUS);
+				goto ERR_EXIT;
+			}
+			break;
+		case 'f':
+			g_format = perf_format_parse(optarg);
+			if (g_format < 0) {
+				printf("ERROR: Unknown format \"%s\"\n", optarg);
+				goto ERR_EXIT;
+			}
+			break;
 		default:
-			if (!p_case->getopt(p_case, opt))
-				break;
-			printf("ERROR: Invalid parameter, please run \"./perf_case -h\" for help.\n");
-			exit(0);
+			if (parse_case_opt(p_case, opt))
+				goto ERR_EXIT;
+			break;
+		}
+	}
+
+	free(opts);
+	free(ostr);
+
+	if (g_threads > 1) {
+		if (!p_case->threaded) {
+			printf("ERROR: %s does not run on threads.\n", p_case->name);
+			return ERROR;
+		}
+		if (g_cpu_num > 1 && g_cpu_num != g_threads) {
+			printf("ERROR: Give one CPU or one CPU per thread.\n");
+			return ERROR;
+		}
+		if (g_min_time) {
+			printf("ERROR: Min time can not scale iterations of threads.\n");
+			return ERROR;
 		}
 	}
 
-	init_cpu(opt_cpu);
+	/* A counted command labels the results too. */
+	for (char **word = p_case->command; word && *word; word++) {
+		k = strlen(g_params);
+		snprintf(g_params + k, PARAMS_LEN - k, "%s%s%s",	\
+			k ? " " : "", word == p_case->command ? "-- " : "", *word);
+	}
+
+	// The sampler follows perf_case's own thread, a counted process is not sampled.
+	if (p_case->any_cpu && g_sample) {
+		printf("ERROR: %s can not sample.\n", p_case->name);
+		return ERROR;
+	}
+
+	return init_cpu(g_cpus[0]);
 
+ERR_EXIT:
 	free(opts);
+	free(ostr);
+	return ERROR;
+}
+
+/*
+ * Suite runner
+ *
+ * A suite is a file with one case (or glob of cases) per line followed by
+ * its options, or a glob pattern of case names. Each entry gets the
+ * options given on the command line plus its own, runs in this process
+ * and a failing entry does not stop the rest. With -o the report of each
+ * entry goes to <dir>/<case>.txt, entries of the same case append to the
+ * same file.
+ */
+
+#define MAX_SUITE_ARGS		64
+#define MAX_SUITE_LINE		1024
+
+struct perf_suite {
+	char *out_dir;
+	char **opts;
+	int opts_num;
+	char **outputs;
+	int output_num;
+	int entry_num;
+	int fail_num;
+};
+
+static int suite_output_seen(struct perf_suite *p_suite, const char *name)
+{
+	for (int i = 0; i < p_suite->output_num; i++)
+		if (!strcmp(p_suite->outputs[i], name))
+			return 1;
+
+	p_suite->outputs = realloc(p_suite->outputs, sizeof(char*) * (p_suite->output_num + 1));
+	p_suite->outputs[p_suite->output_num++] = strdup(name);
+
+	return 0;
+}
+
+static int run_suite_entry(struct perf_suite *p_suite, char *case_name, char **entry_opts, int entry_opts_num)
+{
+	struct perf_case *p_case;
+	char *argv[MAX_SUITE_ARGS];
+	char path[PATH_MAX], records[PATH_MAX];
+	int argc = 0, saved = -1, append = 0, err;
+
+	p_suite->entry_num++;
+
+	p_case = perf_case_find(case_name);
+	if (!p_case) {
+		printf("ERROR: No case named \"%s\"\n", case_name);
+		goto ERR_EXIT;
+	}
+
+	if (p_suite->opts_num + entry_opts_num + 2 > MAX_SUITE_ARGS) {
+		printf("ERROR: Too many options for %s.\n", case_name);
+		goto ERR_EXIT;
+	}
+
+	argv[argc++] = "perf_case";
+	argv[argc++] = case_name;
+	for (int i = 0; i < p_suite->opts_num; i++)
+		argv[argc++] = p_suite->opts[i];
+	for (int i = 0; i < entry_opts_num; i++)
+		argv[argc++] = entry_opts[i];
+	argv[argc] = NULL;
+
+	if (p_suite->out_dir) {
+		snprintf(path, sizeof(path), "%s/%s.txt", p_suite->out_dir, case_name);
+		append = suite_output_seen(p_suite, case_name);
+		saved = redirect_stdout(path, append);
+		if (saved < 0)
+			goto ERR_EXIT;
+	}
+
+	err = init_opts(p_case, argc, argv);
+	if (err == HELP) {
+		restore_stdout(saved);
+		return SUCCESS;
+	}
+
+	/* Records of a structured format go next to the text report. */
+	if (!err && p_suite->out_dir && g_format != PERF_FORMAT_TEXT) {
+		snprintf(records, sizeof(records), "%s/%s.%s", p_suite->out_dir,	\
+			case_name, g_format == PERF_FORMAT_JSON ? "json" : "csv");
+		g_output = records;
+		g_output_append = append;
+	}
+
+	if (!err)
+		err = run_case(p_case, argc, argv);
+
+	restore_stdout(saved);
+
+	if (err)
+		goto ERR_EXIT;
+
+	return SUCCESS;
+
+ERR_EXIT:
+	printf("FAILED: %s\n", case_name);
+	p_suite->fail_num++;
+	return ERROR;
+}
+
+static void run_suite_glob(struct perf_suite *p_suite, const char *pattern, char **entry_opts, int entry_opts_num)
+{
+	int case_num = sizeof(perf_cases) / sizeof(struct perf_case*);
+
+	if (!strpbrk(pattern, "*?[")) {
+		run_suite_entry(p_suite, (char*)pattern, entry_opts, entry_opts_num);
+		return;
+	}
+
+	for (int i = 0; i < case_num; i++)
+		if (!fnmatch(pattern, perf_cases[i]->name, 0))
+			run_suite_entry(p_suite, perf_cases[i]->name, entry_opts, entry_opts_num);
+}
+
+static void run_suite_file(struct perf_suite *p_suite, FILE *file)
+{
+	char line[MAX_SUITE_LINE];
+	char *args[MAX_SUITE_ARGS];
+	char *token;
+	int num;
+
+	while (fgets(line, sizeof(line), file)) {
+		num = 0;
+		for (token = strtok(line, " \t\r\n"); token && num < MAX_SUITE_ARGS; token = strtok(NULL, " \t\r\n")) {
+			if (token[0] == '#')
+				break;
+			args[num++] = token;
+		}
+		if (!num)
+			continue;
+		/* strtok is not reentrant, keep our tokens before running the entry */
+		for (int i = 0; i < num; i++)
+			args[i] = strdup(args[i]);
+		run_suite_glob(p_suite, args[0], args + 1, num - 1);
+		for (int i = 0; i < num; i++)
+			free(args[i]);
+	}
+}
+
+int run_suite(const char *spec, int argc, char **argv)
+{
+	struct perf_suite suite;
+	FILE *file;
+
+	memset(&suite, 0, sizeof(struct perf_suite));
+	suite.opts = malloc(sizeof(char*) * (argc + 1));
+
+	/* The output directory belongs to the suite, other options go to every entry. */
+	for (int i = 0; i < argc; i++) {
+		if ((!strcmp(argv[i], "-o") || !strcmp(argv[i], "--output")) && i + 1 < argc)
+			suite.out_dir = argv[++i];
+		else if (!strncmp(argv[i], "--output=", 9))
+			suite.out_dir = argv[i] + 9;
+		else
+			suite.opts[suite.opts_num++] = argv[i];
+	}
+
+	if (suite.out_dir && mkdir(suite.out_dir, 0755) && errno != EEXIST) {
+		printf("ERROR: Can not create output directory: %s\n", suite.out_dir);
+		free(suite.opts);
+		return ERROR;
+	}
+
+	file = fopen(spec, "r");
+	if (file) {
+		run_suite_file(&suite, file);
+		fclose(file);
+	} else {
+		run_suite_glob(&suite, spec, NULL, 0);
+	}
+
+	printf("suite finished: %d entries, %d failed\n", suite.entry_num, suite.fail_num);
+
+	for (int i = 0; i < suite.output_num; i++)
+		free(suite.outputs[i]);
+	free(suite.outputs);
+	free(suite.opts);
+
+	return suite.fail_num ? ERROR : SUCCESS;
 }
 
 int main(int argc, char **argv)
 {
 	char *case_name;
 	struct perf_case *p_case;
+	int saved = -1;
 
 	if (argc < 2) {
 		print_help();
@@ -628,6 +2239,17 @@ int main(int argc, char **argv)
 		return 0;
 	}
 
+	if (!strcmp(argv[1], "compare"))
+		return perf_compare(argc - 1, argv + 1);
+
+	if (!strcmp(argv[1], "--suite")) {
+		if (argc < 3) {
+			print_help();
+			return 0;
+		}
+		return run_suite(argv[2], argc - 3, argv + 3) ? 1 : 0;
+	}
+
 	case_name = argv[1];
 
 	p_case = perf_case_find(case_name);
@@ -636,9 +2258,28 @@ int main(int argc, char **argv)
 		return 0;
 	}
 
-	init_opts(p_case, argc, argv);
+	/* The command of exec follows "--", its options are not ours. */
+	for (int i = 2; i < argc; i++) {
+		if (!strcmp(argv[i], "--")) {
+			p_case->command = argv + i + 1;
+			argc = i;
+			break;
+		}
+	}
+
+	if (init_opts(p_case, argc, argv))
+		return 0;
+
+	/* Structured formats write records to the output file themselves. */
+	if (g_output && g_format == PERF_FORMAT_TEXT) {
+		saved = redirect_stdout(g_output, 0);
+		if (saved < 0)
+			return 0;
+	}
 
 	run_case(p_case, argc, argv);
 
+	restore_stdout(saved);
+
 	return 0;
 }
@@ -1,6 +1,7 @@
 #ifndef __PERF_CASE_H
 #define __PERF_CASE_H
 
+#include <stdio.h>
 #include <getopt.h>
 
 #include "perf_stat.h"
@@ -35,25 +36,92 @@ struct perf_case {
 	void* data;
 	int  (*init)(struct perf_case *p_case, struct perf_stat *p_stat, int argc, char *argv[]);
 	int  (*exit)(struct perf_case *p_case, struct perf_stat *p_stat);
+	int  (*reset)(struct perf_case *p_case, struct perf_stat *p_stat);
 	void (*func)(struct perf_case *p_case, struct perf_stat *p_stat);
 	void (*help)(struct perf_case *p_case);
 	int  (*getopt)(struct perf_case *p_case, int opt);
+	int  (*get_iterations)(struct perf_case *p_case);
+	void (*set_iterations)(struct perf_case *p_case, int iterations);
+	void (*reset_opts)(struct perf_case *p_case);
 	struct perf_option *opts;
 	int opts_num;
 	struct perf_event *events;
 	int event_num;
 	int inner_stat;
+	int threaded;			/* func splits its work by p_stat->thread_id */
+	int any_cpu;			/* counts another task on every CPU unless -c is given */
+	char **command;			/* the words after "--" on the command line */
+};
+
+#define PARAMS_LEN		256
+
+enum perf_format {
+	PERF_FORMAT_TEXT,
+	PERF_FORMAT_JSON,
+	PERF_FORMAT_CSV,
+};
+
+struct perf_result {
+	long *durations;		/* [repeat] */
+	uint64_t *counts;		/* [repeat][event_num] */
+	struct perf_metric *metrics;	/* [repeat][MAX_STAT_METRICS] */
+	int metric_num;
+	long **series_times;		/* [repeat][series_num], NULL without interval */
+	uint64_t **series_counts;	/* [repeat][series_num][event_num] */
+	int *series_num;		/* [repeat] */
 };
 
 struct perf_run {
 	struct perf_case *p_case;
+	char params[PARAMS_LEN];
+	char *eventset;
+	int cpu;
+	struct perf_event *events;	/* events packed into groups, stats point here */
+	int event_num;
+	int supported_num;		/* events[supported_num..] could not be counted */
+	int *event_status;		/* enum perf_event_status of each event */
+	struct perf_event *split_events;	/* ":u" and ":k" copies with --split-priv */
+	int split_num;
 	struct perf_stat *stats;
+	struct perf_result *results;	/* [stat_num] */
 	int stat_num;
+	int repeat;
+	int warmup;
+	int calibrate;
+	int subtract;
+	long min_time;
+	long interval;
+	int iterations;
+	int runs;			/* runs of func so far, see reset */
 	long max_dur;
 	long min_dur;
 	long avg_dur;
 };
 
+/* perf_case.c */
+struct perf_event* perf_event_find(const char *name);
+double perf_run_count(struct perf_run *p_run, int i, int r, int j, int corrected);
+double perf_run_duration(struct perf_run *p_run, int i, int r, int corrected);
+
+/* perf_derive.c */
+void perf_derive_report(struct perf_run *p_run);
+void perf_derive_topdown(struct perf_run *p_run);
+
+/* perf_result.c */
+int perf_format_parse(const char *name);
+void perf_result_write(FILE *file, struct perf_run *p_run, int format, int header);
+
+/* perf_eventset.c */
+struct perf_eventset* perf_eventset_load(const char *spec);
+void perf_eventset_free(struct perf_eventset *set);
+
+/* perf_compare.c */
+int perf_compare(int argc, char **argv);
+
+/* perf_exec.c */
+PERF_CASE_DECLARE(exec);
+PERF_CASE_DECLARE(attach);
+
 PERF_CASE_DECLARE(memset_malloc);
 PERF_CASE_DECLARE(memset_malloc_x2);
 PERF_CASE_DECLARE(memset_mmap);
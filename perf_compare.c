@@ -0,0 +1,387 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <limits.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <sys/stat.h>
+
+#include "perf_stat.h"
+#include "perf_case.h"
+#include "perf_summary.h"
+
+/*
+ * Compare two result sets written with "-f csv".
+ *
+ * Values are matched by case, params, group, kind and name, so runs on
+ * different CPUs can be compared. Every group measures its own runs, a
+ * value is not pooled over groups. Nor over the CPUs of a threaded run,
+ * the n-th CPU of a case on one side meets the n-th on the other.
+ * Each value prints the median of both sides, the delta and the
+ * Mann-Whitney p-value over the repeats. Duration and metrics gate the
+ * result: a significant change worse than the threshold is a regression
+ * and makes the command exit with 1.
+ */
+
+#define CSV_FIELDS		10
+#define CSV_LINE_LEN		1024
+#define COMPARE_ALPHA		0.05
+#define COMPARE_THRESHOLD	5.0
+
+enum {
+	CSV_CASE, CSV_PARAMS, CSV_CPU, CSV_EVENTSET, CSV_GROUP,
+	CSV_REPEAT, CSV_KIND, CSV_NAME, CSV_VALUE, CSV_UNIT,
+};
+
+struct compare_entry {
+	char *case_name;
+	char *params;
+	int cpu;
+	int cpu_idx;			/* n-th CPU of the case and params in its set */
+	char *group;
+	char *kind;
+	char *name;
+	char *unit;
+	double *values;
+	int num;
+};
+
+struct compare_set {
+	struct compare_entry *entries;
+	int entry_num;
+};
+
+static struct perf_option compare_options[] = {
+	{{"alpha",     optional_argument, NULL, 'a' }, "a:", "Significance level of the test. (default: 0.05)"},
+	{{"threshold", optional_argument, NULL, 't' }, "t:", "Regression threshold in percent. (default: 5)"},
+	{{"all",       no_argument,       NULL, 'A' }, "A",  "Show unchanged values too."},
+	{{"help",      no_argument,       NULL, 'h' }, "h",  "Help."},
+};
+
+// Split a CSV line in place, quoted fields may hold commas and doubled quotes.
+static int csv_split(char *line, char **fields, int max)
+{
+	char *src = line, *dst;
+	int num = 0;
+
+	while (num < max) {
+		fields[num++] = dst = src;
+		if (*src == '"') {
+			src++;
+			while (*src) {
+				if (*src == '"' && *(src + 1) == '"') {
+					*dst++ = '"';
+					src += 2;
+				} else if (*src == '"') {
+					src++;
+					break;
+				} else {
+					*dst++ = *src++;
+				}
+			}
+		} else {
+			while (*src && *src != ',' && *src != '\n' && *src != '\r')
+				*dst++ = *src++;
+		}
+		if (*src != ',') {
+			*dst = '\0';
+			break;
+		}
+		*dst = '\0';
+		src++;
+	}
+
+	return num;
+}
+
+static struct compare_entry* compare_find(struct compare_set *set, char **fields, int cpu_idx)
+{
+	struct compare_entry *entry;
+
+	for (int i = 0; i < set->entry_num; i++) {
+		entry = &set->entries[i];
+		if (!strcmp(entry->case_name, fields[CSV_CASE]) &&	\
+		    !strcmp(entry->params, fields[CSV_PARAMS]) &&	\
+		    entry->cpu_idx == cpu_idx &&			\
+		    !strcmp(entry->group, fields[CSV_GROUP]) &&		\
+		    !strcmp(entry->kind, fields[CSV_KIND]) &&		\
+		    !strcmp(entry->name, fields[CSV_NAME]))
+			return entry;
+	}
+
+	return NULL;
+}
+
+// Number the CPUs of a case and params in the order they first show up.
+static int compare_cpu_idx(struct compare_set *set, char **fields, int cpu)
+{
+	struct compare_entry *entry;
+	int idx = 0;
+
+	for (int i = 0; i < set->entry_num; i++) {
+		entry = &set->entries[i];
+		if (strcmp(entry->case_name, fields[CSV_CASE]) || strcmp(entry->params, fields[CSV_PARAMS]))
+			continue;
+		if (entry->cpu == cpu)
+			return entry->cpu_idx;
+		if (entry->cpu_idx >= idx)
+			idx = entry->cpu_idx + 1;
+	}
+
+	return idx;
+}
+
+static void compare_add(struct compare_set *set, char **fields)
+{
+	struct compare_entry *entry;
+	int cpu, cpu_idx;
+
+	cpu = atoi(fields[CSV_CPU]);
+	cpu_idx = compare_cpu_idx(set, fields, cpu);
+
+	entry = compare_find(set, fields, cpu_idx);
+	if (!entry) {
+		set->entries = realloc(set->entries, sizeof(struct compare_entry) * (set->entry_num + 1));
+		entry = &set->entries[set->entry_num++];
+		memset(entry, 0, sizeof(struct compare_entry));
+		entry->case_name = strdup(fields[CSV_CASE]);
+		entry->params = strdup(fields[CSV_PARAMS]);
+		entry->cpu = cpu;
+		entry->cpu_idx = cpu_idx;
+		entry->group = strdup(fields[CSV_GROUP]);
+		entry->kind = strdup(fields[CSV_KIND]);
+		entry->name = strdup(fields[CSV_NAME]);
+		entry->unit = strdup(fields[CSV_UNIT]);
+	}
+
+	entry->values = realloc(entry->values, sizeof(double) * (entry->num + 1));
+	entry->values[entry->num++] = atof(fields[CSV_VALUE]);
+}
+
+static int compare_load_file(struct compare_set *set, const char *path)
+{
+	char line[CSV_LINE_LEN];
+	char *fields[CSV_FIELDS];
+	FILE *file;
+
+	file = fopen(path, "r");
+	if (!file) {
+		printf("ERROR: Can not open %s\n", path);
+		return ERROR;
+	}
+
+	while (fgets(line, sizeof(line), file)) {
+		if (!strncmp(line, "case,", 5))
+			continue;
+		if (csv_split(line, fields, CSV_FIELDS) != CSV_FIELDS)
+			continue;
+		// Overhead is a property of the measurement, not of the case.
+		if (!strcmp(fields[CSV_KIND], "overhead"))
+			continue;
+		// Interval timestamps never match between runs.
+		if (!strcmp(fields[CSV_KIND], "series"))
+			continue;
+		// Nothing was counted, there is no value to compare.
+		if (!strcmp(fields[CSV_KIND], "unsupported"))
+			continue;
+		compare_add(set, fields);
+	}
+
+	fclose(file);
+
+	return SUCCESS;
+}
+
+// A result set is one csv file or a directory of them, e.g. a suite output.
+static int compare_load(struct compare_set *set, const char *path)
+{
+	char file_path[PATH_MAX];
+	struct dirent *dent;
+	struct stat st;
+	int len, err = SUCCESS;
+	DIR *dir;
+
+	if (stat(path, &st)) {
+		printf("ERROR: Can not open %s\n", path);
+		return ERROR;
+	}
+
+	if (!S_ISDIR(st.st_mode))
+		return compare_load_file(set, path);
+
+	dir = opendir(path);
+	if (!dir) {
+		printf("ERROR: Can not open %s\n", path);
+		return ERROR;
+	}
+
+	while ((dent = readdir(dir))) {
+		len = strlen(dent->d_name);
+		if (len < 4 || strcmp(dent->d_name + len - 4, ".csv"))
+			continue;
+		snprintf(file_path, sizeof(file_path), "%s/%s", path, dent->d_name);
+		err |= compare_load_file(set, file_path);
+	}
+
+	closedir(dir);
+
+	return err;
+}
+
+static void compare_free(struct compare_set *set)
+{
+	struct compare_entry *entry;
+
+	for (int i = 0; i < set->entry_num; i++) {
+		entry = &set->entries[i];
+		free(entry->case_name);
+		free(entry->params);
+		free(entry->group);
+		free(entry->kind);
+		free(entry->name);
+		free(entry->unit);
+		free(entry->values);
+	}
+	free(set->entries);
+}
+
+// Rates are better when higher, time, latency and counts when lower.
+static int higher_is_better(struct compare_entry *entry)
+{
+	return !strcmp(entry->kind, "metric") && strstr(entry->unit, "/s");
+}
+
+// Only duration and case metrics decide a regression, counters are context.
+static int gates(struct compare_entry *entry)
+{
+	return !strcmp(entry->kind, "time") || !strcmp(entry->kind, "metric");
+}
+
+static void print_compare_help()
+{
+	int num = sizeof(compare_options) / sizeof(struct perf_option);
+
+	printf("Usage:\n");
+	printf("    ./perf_case compare [A] [B] [options]\n");
+	printf("                                      // compare csv results, file or directory\n");
+	printf("Options:\n");
+	for (int i = 0; i < num; i++)
+		printf("    -%c, --%-24s %s\n", compare_options[i].opt.val, compare_options[i].opt.name, compare_options[i].desc);
+	printf("Exit code:\n");
+	printf("    0: no regression, 1: regression found, 2: error\n");
+}
+
+int perf_compare(int argc, char **argv)
+{
+	struct compare_set set_a, set_b;
+	struct compare_entry *a, *b;
+	struct option opts[sizeof(compare_options) / sizeof(struct perf_option) + 1];
+	double med_a, med_b, delta, pct, p;
+	double alpha = COMPARE_ALPHA, threshold = COMPARE_THRESHOLD;
+	char ostr[16] = "";
+	char *key[CSV_FIELDS];
+	struct compare_entry *last = NULL;
+	int num = sizeof(compare_options) / sizeof(struct perf_option);
+	int opt, show_all = 0, significant, regression, regressions = 0, compared = 0;
+	char *flag;
+
+	for (int i = 0; i < num; i++) {
+		opts[i] = compare_options[i].opt;
+		strcat(ostr, compare_options[i].ostr);
+	}
+	memset(&opts[num], 0, sizeof(struct option));
+
+	optind = 0;
+	while ((opt = getopt_long(argc, argv, ostr, opts, NULL)) != -1) {
+		switch (opt) {
+		case 'a':
+			alpha = atof(optarg);
+			break;
+		case 't':
+			threshold = atof(optarg);
+			break;
+		case 'A':
+			show_all = 1;
+			break;
+		case 'h':
+			print_compare_help();
+			return 0;
+		default:
+			print_compare_help();
+			return 2;
+		}
+	}
+
+	if (argc - optind != 2) {
+		print_compare_help();
+		return 2;
+	}
+
+	memset(&set_a, 0, sizeof(struct compare_set));
+	memset(&set_b, 0, sizeof(struct compare_set));
+
+	if (compare_load(&set_a, argv[optind]) || compare_load(&set_b, argv[optind + 1])) {
+		compare_free(&set_a);
+		compare_free(&set_b);
+		return 2;
+	}
+
+	printf("A: %s\n", argv[optind]);
+	printf("B: %s\n", argv[optind + 1]);
+	printf("alpha: %.3f, threshold: %.2f%%\n", alpha, threshold);
+	printf("-----------------------\n");
+	printf("    %-24s  %16s %16s %16s %9s %7s\n", "", "A median", "B median", "delta", "%", "p");
+
+	for (int i = 0; i < set_a.entry_num; i++) {
+		a = &set_a.entries[i];
+		key[CSV_CASE] = a->case_name;
+		key[CSV_PARAMS] = a->params;
+		key[CSV_GROUP] = a->group;
+		key[CSV_KIND] = a->kind;
+		key[CSV_NAME] = a->name;
+
+		b = compare_find(&set_b, key, a->cpu_idx);
+		if (!b)
+			continue;
+
+		compared++;
+
+		/* medians sort the samples, the rank test does not care */
+		med_a = perf_summary_median(a->values, a->num);
+		med_b = perf_summary_median(b->values, b->num);
+		delta = med_b - med_a;
+		pct = med_a != 0 ? delta / fabs(med_a) * 100 : 0;
+		p = perf_summary_mannwhitney(a->values, a->num, b->values, b->num);
+
+		significant = p < alpha;
+		regression = significant && gates(a) &&					\
+			(higher_is_better(a) ? -pct : pct) > threshold;
+		regressions += regression;
+
+		if (!show_all && !significant)
+			continue;
+
+		if (!last || strcmp(last->case_name, a->case_name) || strcmp(last->params, a->params) ||	\
+		    last->cpu_idx != a->cpu_idx || strcmp(last->group, a->group)) {
+			printf("%s%s%s (cpu %d / %d, group %s)\n", a->case_name, a->params[0] ? " " : "",	\
+				a->params, a->cpu, b->cpu, a->group);
+			last = a;
+		}
+
+		flag = regression ? "REGRESSION" : (significant ? "*" : "");
+		printf("    %-24s: %16.3f %16.3f %+16.3f %+8.2f%% %7.4f %s\n",	\
+			!strcmp(a->kind, "time") ? "time (ns)" : a->name,		\
+			med_a, med_b, delta, pct, p, flag				\
+		);
+	}
+
+	printf("-----------------------\n");
+	printf("compared %d values, %d regressions\n", compared, regressions);
+	printf("    (*) significant change, p < alpha of the Mann-Whitney U test over the repeats\n");
+
+	compare_free(&set_a);
+	compare_free(&set_b);
+
+	return regressions ? 1 : 0;
+}
@@ -0,0 +1,142 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <glob.h>
+
+#include "perf_stat.h"
+#include "perf_cpu.h"
+
+/*
+ * CPU lists use the kernel cpulist format ("0-3,8,10-11"), "all" is every
+ * online CPU. Topology is read from /sys/devices/system/cpu/cpu<N>/ and the
+ * core PMU of a CPU is the event source device whose "cpus" lists it, so
+ * big.LITTLE parts with one PMU per core type can be told apart.
+ */
+
+#define CPU_SYSFS		"/sys/devices/system/cpu"
+#define CPU_LIST_LEN		1024
+
+static int read_line(const char *path, char *buf, int len)
+{
+	FILE *file;
+	char *ret;
+
+	file = fopen(path, "r");
+	if (!file)
+		return ERROR;
+
+	ret = fgets(buf, len, file);
+	fclose(file);
+	if (!ret)
+		return ERROR;
+
+	buf[strcspn(buf, "\n")] = '\0';
+
+	return SUCCESS;
+}
+
+static int read_int(const char *path, int def)
+{
+	char buf[32];
+
+	if (read_line(path, buf, sizeof(buf)))
+		return def;
+
+	return atoi(buf);
+}
+
+// Returns the number of CPUs in the list, ERROR if it does not parse.
+int perf_cpu_parse_list(const char *str, int *cpus, int max)
+{
+	char online[CPU_LIST_LEN];
+	const char *p;
+	char *end;
+	long first, last;
+	int num = 0;
+
+	if (!strcmp(str, "all")) {
+		if (read_line(CPU_SYSFS "/online", online, sizeof(online)))
+			return ERROR;
+		str = online;
+	}
+
+	for (p = str; *p; ) {
+		if (!isdigit(*p))
+			return ERROR;
+		first = last = strtol(p, &end, 10);
+		if (*end == '-') {
+			p = end + 1;
+			if (!isdigit(*p))
+				return ERROR;
+			last = strtol(p, &end, 10);
+		}
+		if (last < first)
+			return ERROR;
+		for (long cpu = first; cpu <= last; cpu++) {
+			if (num == max)
+				return ERROR;
+			cpus[num++] = cpu;
+		}
+		p = end;
+		if (*p == ',')
+			p++;
+		else if (*p)
+			return ERROR;
+	}
+
+	return num ? num : ERROR;
+}
+
+static int cpu_in_list(const char *path, int cpu)
+{
+	char buf[CPU_LIST_LEN];
+	int cpus[MAX_CPUS];
+	int num;
+
+	if (read_line(path, buf, sizeof(buf)))
+		return 0;
+
+	num = perf_cpu_parse_list(buf, cpus, MAX_CPUS);
+	for (int i = 0; i < num; i++)
+		if (cpus[i] == cpu)
+			return 1;
+
+	return 0;
+}
+
+void perf_cpu_topology(int cpu, struct perf_cpu *info)
+{
+	char path[256], *name;
+	glob_t paths;
+
+	memset(info, 0, sizeof(struct perf_cpu));
+	info->id = cpu;
+
+	// Clusters are reported since 5.16, older kernels only have the package.
+	snprintf(path, sizeof(path), CPU_SYSFS "/cpu%d/topology/cluster_id", cpu);
+	info->cluster = read_int(path, -1);
+	if (info->cluster < 0) {
+		snprintf(path, sizeof(path), CPU_SYSFS "/cpu%d/topology/physical_package_id", cpu);
+		info->cluster = read_int(path, -1);
+	}
+
+	snprintf(path, sizeof(path), CPU_SYSFS "/cpu%d/cpu_capacity", cpu);
+	info->capacity = read_int(path, 0);
+
+	snprintf(info->pmu, CPU_PMU_LEN, "-");
+	if (glob("/sys/bus/event_source/devices/*/cpus", 0, NULL, &paths))
+		return;
+
+	for (int i = 0; i < paths.gl_pathc; i++) {
+		if (!cpu_in_list(paths.gl_pathv[i], cpu))
+			continue;
+		// devices/<pmu>/cpus
+		*strrchr(paths.gl_pathv[i], '/') = '\0';
+		name = strrchr(paths.gl_pathv[i], '/') + 1;
+		snprintf(info->pmu, CPU_PMU_LEN, "%s", name);
+		break;
+	}
+
+	globfree(&paths);
+}
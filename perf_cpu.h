@@ -0,0 +1,19 @@
+#ifndef __PERF_CPU_H
+#define __PERF_CPU_H
+
+#define MAX_CPUS		256
+#define CPU_PMU_LEN		32
+
+// Where a CPU sits in a heterogeneous system, -1 or 0 if not reported.
+struct perf_cpu {
+	int id;
+	int cluster;
+	int capacity;
+	char pmu[CPU_PMU_LEN];
+};
+
+/* cpu lists and topology from sysfs */
+int perf_cpu_parse_list(const char *str, int *cpus, int max);
+void perf_cpu_topology(int cpu, struct perf_cpu *info);
+
+#endif
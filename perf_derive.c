@@ -0,0 +1,333 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <glob.h>
+
+#include "perf_stat.h"
+#include "perf_case.h"
+#include "perf_summary.h"
+
+/*
+ * Derived metrics
+ *
+ * Each metric is num * scale / den over the median counts of a run. An
+ * operand lists event names separated by "|", the first one collected is
+ * used, so a metric works with both the generic and the raw event names.
+ * Two pseudo events are available: "time" is the run duration in ns and
+ * "ops" is the op count reported by the case with a metric in "ops" unit.
+ * Metrics with an operand that was not collected are skipped.
+ */
+
+#define OPERAND_LEN		128
+#define TOPDOWN_SLOTS		4
+
+struct perf_derived {
+	char *name;
+	char *num;
+	char *den;
+	double scale;
+};
+
+#define INSTRUCTIONS	"instructions|inst_retired"
+#define CYCLES		"cpu-cycles|cpu_cycles"
+
+static struct perf_derived derived_metrics[] = {
+	/* core */
+	{"ipc",				INSTRUCTIONS,				CYCLES,			1},
+	{"cpi",				CYCLES,					INSTRUCTIONS,		1},
+	{"stall_frontend_ratio",	"stall-frontend|stall_frontend",	CYCLES,			1},
+	{"stall_backend_ratio",		"stall-backend|stall_backend",		CYCLES,			1},
+
+	/* branch */
+	{"branch_miss_ratio",		"br_miss_pred_retired|br_miss_pred",	"br_retired|br_pred",	1},
+	{"branch_mpki",			"br_miss_pred_retired|br_miss_pred",	INSTRUCTIONS,		1000},
+
+	/* cache */
+	{"cache_miss_ratio",		"cache-misses",				"cache-refs",		1},
+	{"l1i_mpki",			"l1i_cache_refill",			INSTRUCTIONS,		1000},
+	{"l1d_miss_ratio",		"l1d_cache_refill",			"l1d_cache",		1},
+	{"l1d_mpki",			"l1d_cache_refill",			INSTRUCTIONS,		1000},
+	{"l2d_miss_ratio",		"l2d_cache_refill",			"l2d_cache",		1},
+	{"l2d_mpki",			"l2d_cache_refill",			INSTRUCTIONS,		1000},
+	{"l3d_miss_ratio",		"l3d_cache_refill",			"l3d_cache",		1},
+	{"llc_miss_ratio",		"llc_cache_miss_rd",			"llc_cache_rd",		1},
+
+	/* tlb */
+	{"itlb_walk_rate",		"itlb_walk",				"l1i_tlb",		1},
+	{"dtlb_walk_rate",		"dtlb_walk",				"l1d_tlb",		1},
+	{"dtlb_walk_pki",		"dtlb_walk",				INSTRUCTIONS,		1000},
+
+	/* bus, 64 byte per access */
+	{"bus_bytes_per_cycle",		"bus_access",				"bus_cycles",		64},
+
+	/* per op of the case */
+	{"ns_per_op",			"time",					"ops",			1},
+	{"cycles_per_op",		CYCLES,					"ops",			1},
+	{"inst_per_op",			INSTRUCTIONS,				"ops",			1},
+	{"l1d_refill_per_op",		"l1d_cache_refill",			"ops",			1},
+	{"cache_miss_per_op",		"cache-misses",				"ops",			1},
+};
+
+// Median over the repeats of one collected event, ERROR if not collected.
+static int event_value(struct perf_run *p_run, const char *name, double *value, double *samples)
+{
+	struct perf_stat *p_stat;
+	struct perf_result *p_result;
+
+	if (!strcmp(name, "time")) {
+		for (int r = 0; r < p_run->repeat; r++)
+			samples[r] = perf_run_duration(p_run, 0, r, p_run->subtract);
+		*value = perf_summary_median(samples, p_run->repeat);
+		return SUCCESS;
+	}
+
+	if (!strcmp(name, "ops")) {
+		p_result = &p_run->results[0];
+		for (int k = 0; k < p_result->metric_num; k++) {
+			if (strcmp(p_result->metrics[k].unit, "ops"))
+				continue;
+			for (int r = 0; r < p_run->repeat; r++)
+				samples[r] = p_result->metrics[r * MAX_STAT_METRICS + k].value;
+			*value = perf_summary_median(samples, p_run->repeat);
+			return SUCCESS;
+		}
+		return ERROR;
+	}
+
+	for (int i = 0; i < p_run->stat_num; i++) {
+		p_stat = &p_run->stats[i];
+		for (int j = 0; j < p_stat->event_num; j++) {
+			if (!p_stat->events[j].event_name || strcmp(p_stat->events[j].event_name, name))
+				continue;
+			for (int r = 0; r < p_run->repeat; r++)
+				samples[r] = perf_run_count(p_run, i, r, j, p_run->subtract);
+			*value = perf_summary_median(samples, p_run->repeat);
+			return SUCCESS;
+		}
+	}
+
+	return ERROR;
+}
+
+// Resolve "a|b|c" to the first collected event, its name is returned in used.
+static int operand_value(struct perf_run *p_run, const char *operand, double *value, const char **used, double *samples)
+{
+	char buf[OPERAND_LEN], *name, *save;
+
+	snprintf(buf, sizeof(buf), "%s", operand);
+
+	for (name = strtok_r(buf, "|", &save); name; name = strtok_r(NULL, "|", &save)) {
+		if (!event_value(p_run, name, value, samples)) {
+			*used = operand + (name - buf);
+			return SUCCESS;
+		}
+	}
+
+	return ERROR;
+}
+
+void perf_derive_report(struct perf_run *p_run)
+{
+	struct perf_derived *metric;
+	const char *num_name, *den_name;
+	double num, den, *samples;
+	int metric_num = sizeof(derived_metrics) / sizeof(struct perf_derived);
+	int printed = 0;
+
+	samples = malloc(sizeof(double) * p_run->repeat);
+
+	for (int i = 0; i < metric_num; i++) {
+		metric = &derived_metrics[i];
+
+		if (operand_value(p_run, metric->num, &num, &num_name, samples))
+			continue;
+		if (operand_value(p_run, metric->den, &den, &den_name, samples))
+			continue;
+		if (den == 0)
+			continue;
+
+		if (!printed++) {
+			printf("-----------------------\n");
+			printf("derived metrics:\n");
+		}
+
+		printf("    %-24s: %16.3f  (%.*s", metric->name, num * metric->scale / den,	\
+			(int)strcspn(num_name, "|"), num_name);
+		if (metric->scale != 1)
+			printf(" * %g", metric->scale);
+		printf(" / %.*s)\n", (int)strcspn(den_name, "|"), den_name);
+	}
+
+	if (printed && p_run->stat_num > 1)
+		printf("    (events from different groups are medians of separate runs)\n");
+
+	free(samples);
+}
+
+/*
+ * Top-down analysis
+ *
+ * Level 1 splits the issue slots (slots * cycles) into:
+ *
+ *   frontend bound  = STALL_SLOT_FRONTEND / slots - BR_MIS_PRED
+ *   backend bound   = STALL_SLOT_BACKEND / slots
+ *   retiring        = (1 - STALL_SLOT / slots) * OP_RETIRED / OP_SPEC
+ *   bad speculation = (1 - STALL_SLOT / slots) * (1 - OP_RETIRED / OP_SPEC) + BR_MIS_PRED
+ *
+ * with every event per cycle, the recovery cycle after a mispredict is
+ * moved from frontend bound to bad speculation. Level 2 splits backend
+ * bound by STALL_BACKEND_MEM / STALL_BACKEND into memory and core bound.
+ *
+ * Groups are counted in separate runs, so every event is divided by the
+ * cpu_cycles of its own group, or of another run if its group has none.
+ */
+
+// Issue slots per cycle from the core PMU (PMMIR_EL1.SLOTS), 0 if unknown.
+static int topdown_slots()
+{
+	glob_t paths;
+	char buf[32];
+	FILE *file;
+	int slots = 0;
+
+	if (glob("/sys/bus/event_source/devices/*/caps/slots", 0, NULL, &paths))
+		return 0;
+
+	for (int i = 0; i < paths.gl_pathc && !slots; i++) {
+		file = fopen(paths.gl_pathv[i], "r");
+		if (!file)
+			continue;
+		if (fgets(buf, sizeof(buf), file))
+			slots = strtol(buf, NULL, 0);
+		fclose(file);
+	}
+
+	globfree(&paths);
+
+	return slots;
+}
+
+static int find_event(struct perf_stat *p_stat, const char *name)
+{
+	for (int j = 0; j < p_stat->event_num; j++)
+		if (p_stat->events[j].event_name && !strcmp(p_stat->events[j].event_name, name))
+			return j;
+
+	return -1;
+}
+
+/*
+ * Median of an event divided by the median cpu_cycles of the same group,
+ * or of another group when the scheduler put none next to it (mixed).
+ */
+static int per_cycle(struct perf_run *p_run, const char *name, double *value, double *samples, int *mixed)
+{
+	int group = -1, event = -1, cycle_group = -1, cycle = -1, e, c;
+	double count, cycles;
+
+	for (int i = 0; i < p_run->stat_num; i++) {
+		e = find_event(&p_run->stats[i], name);
+		c = find_event(&p_run->stats[i], "cpu_cycles");
+		if (c >= 0 && cycle_group < 0) {
+			cycle_group = i;
+			cycle = c;
+		}
+		if (e < 0)
+			continue;
+		group = i;
+		event = e;
+		if (c >= 0) {
+			cycle_group = i;
+			cycle = c;
+			break;
+		}
+	}
+
+	if (event < 0)
+		return ERROR;
+
+	if (cycle < 0) {
+		printf("topdown: %s not in a group with cpu_cycles\n", name);
+		return ERROR;
+	}
+
+	for (int r = 0; r < p_run->repeat; r++)
+		samples[r] = perf_run_count(p_run, group, r, event, p_run->subtract);
+	count = perf_summary_median(samples, p_run->repeat);
+	for (int r = 0; r < p_run->repeat; r++)
+		samples[r] = perf_run_count(p_run, cycle_group, r, cycle, p_run->subtract);
+	cycles = perf_summary_median(samples, p_run->repeat);
+
+	if (cycles == 0)
+		return ERROR;
+
+	if (cycle_group != group)
+		*mixed = 1;
+
+	*value = count / cycles;
+	return SUCCESS;
+}
+
+static void print_topdown(const char *name, int level, double value)
+{
+	printf("    %*s%-*s: %7.2f%%\n", level * 4, "", 24 - level * 4, name, value * 100);
+}
+
+void perf_derive_topdown(struct perf_run *p_run)
+{
+	double stall, frontend, backend, op_spec, op_retired, mispred, issued, retire_ratio;
+	double stall_backend, stall_mem, mem_ratio;
+	double *samples;
+	int slots, mixed = 0;
+
+	samples = malloc(sizeof(double) * p_run->repeat);
+
+	if (per_cycle(p_run, "stall_slot", &stall, samples, &mixed) ||			\
+	    per_cycle(p_run, "stall_slot_frontend", &frontend, samples, &mixed) ||	\
+	    per_cycle(p_run, "stall_slot_backend", &backend, samples, &mixed) ||	\
+	    per_cycle(p_run, "op_spec", &op_spec, samples, &mixed) ||			\
+	    per_cycle(p_run, "op_retired", &op_retired, samples, &mixed))
+		goto EXIT;
+
+	if (per_cycle(p_run, "br_mis_pred", &mispred, samples, &mixed))
+		mispred = 0;
+
+	slots = topdown_slots();
+
+	printf("-----------------------\n");
+	if (slots) {
+		printf("topdown (slots: %d):\n", slots);
+	} else {
+		slots = TOPDOWN_SLOTS;
+		printf("topdown (slots: %d, not reported by the PMU):\n", slots);
+	}
+
+	stall /= slots;
+	frontend /= slots;
+	backend /= slots;
+	issued = stall < 1 ? 1 - stall : 0;
+	retire_ratio = op_spec > 0 ? op_retired / op_spec : 0;
+	if (retire_ratio > 1)
+		retire_ratio = 1;
+
+	print_topdown("retiring", 0, issued * retire_ratio);
+	print_topdown("bad speculation", 0, issued * (1 - retire_ratio) + mispred);
+	print_topdown("frontend bound", 0, frontend > mispred ? frontend - mispred : 0);
+	print_topdown("backend bound", 0, backend);
+
+	if (!per_cycle(p_run, "stall_backend", &stall_backend, samples, &mixed) &&	\
+	    !per_cycle(p_run, "stall_backend_mem", &stall_mem, samples, &mixed) &&	\
+	    stall_backend > 0) {
+		mem_ratio = stall_mem / stall_backend;
+		if (mem_ratio > 1)
+			mem_ratio = 1;
+		print_topdown("memory bound", 1, backend * mem_ratio);
+		print_topdown("core bound", 1, backend * (1 - mem_ratio));
+	}
+
+	if (mixed)
+		printf("    (some events are divided by the cpu_cycles of another run)\n");
+
+EXIT:
+	free(samples);
+}
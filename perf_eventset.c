@@ -0,0 +1,325 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+
+#include "perf_stat.h"
+#include "perf_case.h"
+#include "perf_pmu.h"
+
+/*
+ * Event sets loaded at runtime
+ *
+ *   -e file:<path>  events listed in a text or JSON file
+ *   -e pmu:<pmu>    every event of /sys/bus/event_source/devices/<pmu>/events
+ *
+ * An event is "<pmu>/<event>" or "<pmu>/<terms>/" (e.g. "cpu/event=0x3c/")
+ * resolved with the PMU registry, "raw:0xNN" for a raw event number
+ * of the core PMU, or the name of an event of a built-in set (cpu-cycles,
+ * l1d_cache_refill, ...). A ":u" or ":k" suffix counts user or kernel
+ * space only, e.g. "cpu-cycles:k". A text file has one event per line with an
+ * optional display name after it, "#" starts a comment:
+ *
+ *   armv8_pmuv3_0/l1d_cache_refill
+ *   raw:0x11  cycles
+ *
+ * A JSON file is an array of events, either strings or objects with
+ * "event" and optional "name", or an object holding such an array:
+ *
+ *   {"events": ["raw:0x8", {"event": "raw:0x11", "name": "cycles"}]}
+ */
+
+#define EVENTSET_LINE_LEN	256
+#define EVENTSET_FILE_MAX	(1024 * 1024)
+#define EVENTSET_JSON_DEPTH	16
+
+// Strip a ":u" or ":k" modifier from spec into priv.
+static int parse_priv(char *spec)
+{
+	int len = strlen(spec);
+
+	if (len < 3 || spec[len - 2] != ':')
+		return PERF_PRIV_ALL;
+
+	switch (spec[len - 1]) {
+	case 'u':
+		spec[len - 2] = '\0';
+		return PERF_PRIV_USER;
+	case 'k':
+		spec[len - 2] = '\0';
+		return PERF_PRIV_KERNEL;
+	default:
+		return PERF_PRIV_ALL;
+	}
+}
+
+// "cpu/event=0x3c/:k" is named "event=0x3c:k".
+static char* pmu_event_name(const char *spec)
+{
+	char *name = strdup(strchr(spec, '/') + 1), *slash;
+
+	slash = strchr(name, '/');
+	if (slash)
+		memmove(slash, slash + 1, strlen(slash));
+
+	return name;
+}
+
+static int eventset_add(struct perf_eventset *set, const char *full_spec, const char *name)
+{
+	struct perf_event *event, *known;
+	char spec[256], *end;
+	int priv;
+
+	snprintf(spec, sizeof(spec), "%s", full_spec);
+	priv = parse_priv(spec);
+
+	set->events = realloc(set->events, sizeof(struct perf_event) * (set->event_num + 1));
+	event = &set->events[set->event_num];
+	memset(event, 0, sizeof(struct perf_event));
+
+	if (!strncmp(spec, "raw:", 4)) {
+		event->type = PERF_TYPE_RAW;
+		event->event_id = strtoull(spec + 4, &end, 0);
+		if (end == spec + 4 || *end) {
+			printf("ERROR: Invalid raw event \"%s\"\n", spec);
+			return ERROR;
+		}
+		event->event_name = strdup(name ? name : full_spec);
+	} else if (strchr(spec, '/')) {
+		// Resolved by perf_pmu_resolve() when the run opens it.
+		event->type = PERF_TYPE_RAW;
+		event->event_path = strdup(spec);
+		event->event_name = name ? strdup(name) : pmu_event_name(full_spec);
+	} else {
+		known = perf_event_find(spec);
+		if (!known) {
+			printf("ERROR: Unknown event \"%s\"\n", spec);
+			return ERROR;
+		}
+		*event = *known;
+		event->event_name = strdup(name ? name : full_spec);
+		event->event_path = known->event_path ? strdup(known->event_path) : NULL;
+	}
+
+	event->priv = priv;
+
+	set->event_num++;
+
+	return SUCCESS;
+}
+
+static int load_text(struct perf_eventset *set, char *buf)
+{
+	char *line, *save, *spec, *name;
+	int line_no = 0;
+
+	for (line = strtok_r(buf, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+		line_no++;
+		line[strcspn(line, "#\r")] = '\0';
+		spec = strtok(line, " \t");
+		if (!spec)
+			continue;
+		name = strtok(NULL, " \t");
+		if (eventset_add(set, spec, name)) {
+			printf("ERROR: At line %d.\n", line_no);
+			return ERROR;
+		}
+	}
+
+	return SUCCESS;
+}
+
+// Read a JSON string in place, p points at the opening quote.
+static char* json_string(char **p)
+{
+	char *src = *p + 1, *dst = src, *str = src;
+
+	while (*src && *src != '"') {
+		if (*src == '\\' && *(src + 1))
+			src++;
+		*dst++ = *src++;
+	}
+	if (!*src)
+		return NULL;
+
+	*dst = '\0';
+	*p = src + 1;
+
+	return str;
+}
+
+/*
+ * Not a full JSON parser: the events are the top level array or the
+ * "events" array of the top level object. Strings in it are events, and in
+ * an object in it the values of "event" and "name" make one event. Anything
+ * else, nested or under other keys, is skipped.
+ */
+static int load_json(struct perf_eventset *set, char *buf)
+{
+	char *p = buf, *str, *key = NULL, *event = NULL, *name = NULL;
+	char stack[EVENTSET_JSON_DEPTH];	/* '{' or '[' of each open container */
+	int events[EVENTSET_JSON_DEPTH];	/* the container is the events array */
+	int depth = 0;
+
+	while (*p) {
+		switch (*p) {
+		case '{':
+		case '[':
+			if (depth == EVENTSET_JSON_DEPTH) {
+				printf("ERROR: JSON nested deeper than %d.\n", EVENTSET_JSON_DEPTH);
+				return ERROR;
+			}
+			events[depth] = *p == '[' && (!depth ||	\
+				(depth == 1 && stack[0] == '{' && key && !strcmp(key, "events")));
+			if (*p == '{' && depth && events[depth - 1])
+				event = name = NULL;
+			stack[depth++] = *p;
+			key = NULL;
+			p++;
+			break;
+		case '}':
+		case ']':
+			if (!depth || stack[depth - 1] != (*p == '}' ? '{' : '[')) {
+				printf("ERROR: Unbalanced %c in JSON.\n", *p);
+				return ERROR;
+			}
+			depth--;
+			if (*p == '}' && depth && events[depth - 1] && event && eventset_add(set, event, name))
+				return ERROR;
+			key = NULL;
+			p++;
+			break;
+		case '"':
+			str = json_string(&p);
+			if (!str) {
+				printf("ERROR: Unterminated string in JSON.\n");
+				return ERROR;
+			}
+			while (isspace(*p))
+				p++;
+			if (*p == ':') {
+				key = str;
+				p++;
+				break;
+			}
+			if (depth && stack[depth - 1] == '[' && events[depth - 1]) {
+				if (eventset_add(set, str, NULL))
+					return ERROR;
+			} else if (depth > 1 && stack[depth - 1] == '{' && events[depth - 2] && key) {
+				if (!strcmp(key, "event"))
+					event = str;
+				else if (!strcmp(key, "name"))
+					name = str;
+			}
+			key = NULL;
+			break;
+		default:
+			p++;
+			break;
+		}
+	}
+
+	if (depth) {
+		printf("ERROR: Unterminated %c in JSON.\n", stack[depth - 1]);
+		return ERROR;
+	}
+
+	return SUCCESS;
+}
+
+static int load_file(struct perf_eventset *set, const char *path)
+{
+	char *buf, *start;
+	FILE *file;
+	long len;
+	int err;
+
+	file = fopen(path, "r");
+	if (!file) {
+		printf("ERROR: Can not open event file: %s\n", path);
+		return ERROR;
+	}
+
+	buf = malloc(EVENTSET_FILE_MAX + 1);
+	len = fread(buf, 1, EVENTSET_FILE_MAX, file);
+	fclose(file);
+	buf[len] = '\0';
+
+	for (start = buf; isspace(*start); start++)
+		;
+
+	if (*start == '[' || *start == '{')
+		err = load_json(set, start);
+	else
+		err = load_text(set, start);
+
+	free(buf);
+
+	return err;
+}
+
+static int load_pmu(struct perf_eventset *set, const char *name)
+{
+	struct perf_pmu *pmu;
+	char spec[256];
+	int err = SUCCESS;
+
+	pmu = perf_pmu_find(name);
+	if (!pmu || !pmu->alias_num) {
+		printf("ERROR: No events found for PMU \"%s\"\n", name);
+		return ERROR;
+	}
+
+	for (int i = 0; i < pmu->alias_num && !err; i++) {
+		snprintf(spec, sizeof(spec), "%s/%s", name, pmu->aliases[i].name);
+		err = eventset_add(set, spec, NULL);
+	}
+
+	return err;
+}
+
+struct perf_eventset* perf_eventset_load(const char *spec)
+{
+	struct perf_eventset *set;
+	int err;
+
+	set = calloc(1, sizeof(struct perf_eventset));
+	if (!set)
+		return NULL;
+
+	set->name = strdup(spec);
+
+	if (!strncmp(spec, "file:", 5))
+		err = load_file(set, spec + 5);
+	else if (!strncmp(spec, "pmu:", 4))
+		err = load_pmu(set, spec + 4);
+	else
+		err = ERROR;
+
+	if (!err && !set->event_num) {
+		printf("ERROR: No events in \"%s\"\n", spec);
+		err = ERROR;
+	}
+
+	if (err) {
+		perf_eventset_free(set);
+		return NULL;
+	}
+
+	return set;
+}
+
+void perf_eventset_free(struct perf_eventset *set)
+{
+	if (!set)
+		return;
+
+	for (int i = 0; i < set->event_num; i++) {
+		free(set->events[i].event_name);
+		free(set->events[i].event_path);
+	}
+	free(set->events);
+	free(set->name);
+	free(set);
+}
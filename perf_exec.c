@@ -0,0 +1,287 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <errno.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include "perf_stat.h"
+#include "perf_case.h"
+
+/*
+ * Count an external process
+ *
+ * "exec" starts a command and counts it until it exits, "attach" counts a
+ * running process for a while. Both run like a case: the command is run,
+ * or the process counted, once per event group and repeat, and reported
+ * the same way. Core events follow the process on every CPU, or on the
+ * CPU given with -c only, and are inherited by the threads and children
+ * it starts while counted.
+ */
+
+#define ATTACH_TIME		1000000000L	/* ns */
+
+static pid_t opt_pid = 0;
+static long opt_time = ATTACH_TIME;
+
+static struct perf_option attach_opts[] = {
+	{{"pid",  optional_argument, NULL, 'p' }, "p:", "Process to count."},
+	{{"time", optional_argument, NULL, 't' }, "t:", "Time to count the process. (e.g. 10s, 500ms, default: 1s)"},
+};
+
+// Let the command run anywhere, perf_case itself is pinned to the first CPU of -c.
+static void allow_all_cpus()
+{
+	cpu_set_t mask;
+
+	CPU_ZERO(&mask);
+	for (int i = 0; i < sysconf(_SC_NPROCESSORS_CONF) && i < CPU_SETSIZE; i++)
+		CPU_SET(i, &mask);
+
+	sched_setaffinity(0, sizeof(mask), &mask);
+}
+
+static int exec_init(struct perf_case *p_case, struct perf_stat *p_stat, int argc, char *argv[])
+{
+	if (!p_case->command || !p_case->command[0]) {
+		printf("ERROR: Give the command to run after \"--\".\n");
+		return ERROR;
+	}
+
+	return SUCCESS;
+}
+
+static void print_status(const char *name, int status)
+{
+	if (WIFEXITED(status) && WEXITSTATUS(status))
+		printf("WARNING: %s exited with %d.\n", name, WEXITSTATUS(status));
+	else if (WIFSIGNALED(status))
+		printf("WARNING: %s was killed by signal %d.\n", name, WTERMSIG(status));
+}
+
+/*
+ * The child waits on a pipe until its counters are open and enabled, so
+ * they see the command from its first instruction. Closing the pipe
+ * without a go lets it exit instead.
+ */
+static void exec_func(struct perf_case *p_case, struct perf_stat *p_stat)
+{
+	char *name = p_case->command[0];
+	int ready[2], status;
+	pid_t pid;
+	char go = 1;
+
+	if (pipe(ready)) {
+		printf("ERROR: Can not create a pipe.\n");
+		return;
+	}
+
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0) {
+		printf("ERROR: Can not start %s.\n", name);
+		close(ready[0]);
+		close(ready[1]);
+		return;
+	}
+
+	if (!pid) {
+		close(ready[1]);
+		if (read(ready[0], &go, 1) != 1)
+			_exit(127);
+		close(ready[0]);
+		if (p_stat->cpu < 0)
+			allow_all_cpus();
+		execvp(name, p_case->command);
+		printf("ERROR: Can not run %s: %s\n", name, strerror(errno));
+		fflush(stdout);
+		_exit(127);
+	}
+
+	close(ready[0]);
+
+	if (perf_stat_attach(p_stat, pid)) {
+		printf("ERROR: Can not count %s.\n", name);
+		close(ready[1]);
+		waitpid(pid, &status, 0);
+		return;
+	}
+
+	perf_stat_begin(p_stat);
+	if (write(ready[1], &go, 1) != 1)
+		printf("ERROR: Can not start %s.\n", name);
+	close(ready[1]);
+	waitpid(pid, &status, 0);
+	perf_stat_end(p_stat);
+
+	print_status(name, status);
+}
+
+static void exec_help(struct perf_case *p_case)
+{
+	printf("Command:\n");
+	printf("    ./perf_case exec [options] -- [command] [args]\n");
+	printf("                                      // the command runs once per event group and repeat\n");
+}
+
+static int attach_getopt(struct perf_case *p_case, int opt)
+{
+	char *unit;
+	double time;
+
+	switch (opt) {
+	case 'p':
+		opt_pid = atoi(optarg);
+		break;
+	case 't':
+		time = strtod(optarg, &unit);
+		if (!strcmp(unit, "ms"))
+			opt_time = time * 1000000;
+		else if (!strcmp(unit, "s") || !*unit)
+			opt_time = time * 1000000000;
+		else
+			return ERROR;
+		break;
+	default:
+		return ERROR;
+	}
+	return SUCCESS;
+}
+
+static void attach_reset_opts(struct perf_case *p_case)
+{
+	opt_pid = 0;
+	opt_time = ATTACH_TIME;
+}
+
+static int attach_init(struct perf_case *p_case, struct perf_stat *p_stat, int argc, char *argv[])
+{
+	if (opt_pid <= 0) {
+		printf("ERROR: Give the process to count with -p.\n");
+		return ERROR;
+	}
+
+	if (opt_time <= 0) {
+		printf("ERROR: Time to count must be positive.\n");
+		return ERROR;
+	}
+
+	// Tell a missing process or permission right away, not once per group.
+	if (perf_stat_attach(p_stat, opt_pid)) {
+		printf("ERROR: Can not count process %d. (see /proc/sys/kernel/perf_event_paranoid)\n", opt_pid);
+		return ERROR;
+	}
+
+	return SUCCESS;
+}
+
+// Threads of the process other than its main thread, which has the pid.
+static int list_threads(pid_t pid, pid_t **tids)
+{
+	char path[64];
+	struct dirent *dent;
+	DIR *dir;
+	int num = 0;
+
+	*tids = NULL;
+
+	snprintf(path, sizeof(path), "/proc/%d/task", pid);
+	dir = opendir(path);
+	if (!dir)
+		return 0;
+
+	while ((dent = readdir(dir))) {
+		if (dent->d_name[0] == '.' || atoi(dent->d_name) == pid)
+			continue;
+		*tids = realloc(*tids, sizeof(pid_t) * (num + 1));
+		(*tids)[num++] = atoi(dent->d_name);
+	}
+
+	closedir(dir);
+
+	return num;
+}
+
+/*
+ * Inherited counters only follow threads started after they are opened,
+ * the threads already running are counted each with their own stat and
+ * added to the main thread's counts.
+ */
+static void attach_func(struct perf_case *p_case, struct perf_stat *p_stat)
+{
+	struct perf_stat *stats;
+	struct timespec time;
+	pid_t *tids;
+	int tid_num, num = 0, err;
+
+	if (perf_stat_attach(p_stat, opt_pid)) {
+		printf("ERROR: Can not count process %d.\n", opt_pid);
+		return;
+	}
+
+	tid_num = list_threads(opt_pid, &tids);
+	stats = calloc(tid_num, sizeof(struct perf_stat));
+
+	for (int k = 0; k < tid_num; k++) {
+		if (p_stat->multiplex)
+			err = perf_stat_init_multiplex(&stats[num], p_stat->name, p_stat->events, p_stat->event_num, p_stat->cpu);
+		else
+			err = perf_stat_init(&stats[num], p_stat->name, p_stat->events, p_stat->event_num, p_stat->cpu);
+		if (err)
+			continue;
+		// A thread that exited meanwhile has nothing left to count.
+		if (perf_stat_attach(&stats[num], tids[k])) {
+			perf_stat_destroy(&stats[num]);
+			continue;
+		}
+		num++;
+	}
+
+	for (int k = 0; k < num; k++)
+		perf_stat_begin(&stats[k]);
+	perf_stat_begin(p_stat);
+
+	time.tv_sec = opt_time / 1000000000L;
+	time.tv_nsec = opt_time % 1000000000L;
+	while (nanosleep(&time, &time) && errno == EINTR)
+		;
+
+	perf_stat_end(p_stat);
+	for (int k = 0; k < num; k++) {
+		perf_stat_end(&stats[k]);
+		for (int j = 0; j < p_stat->event_num; j++)
+			p_stat->event_counts[j] += stats[k].event_counts[j];
+		perf_stat_destroy(&stats[k]);
+	}
+
+	free(stats);
+	free(tids);
+}
+
+PERF_CASE_DEFINE(exec) = {
+	.name = "exec",
+	.desc = "count a command, started once per event group.",
+	.init = exec_init,
+	.func = exec_func,
+	.help = exec_help,
+	.inner_stat = 1,
+	.any_cpu = 1,
+};
+
+PERF_CASE_DEFINE(attach) = {
+	.name = "attach",
+	.desc = "count a running process for a while.",
+	.init = attach_init,
+	.func = attach_func,
+	.getopt = attach_getopt,
+	.reset_opts = attach_reset_opts,
+	.opts = attach_opts,
+	.opts_num = sizeof(attach_opts) / sizeof(struct perf_option),
+	.inner_stat = 1,
+	.any_cpu = 1,
+};
@@ -0,0 +1,350 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <dirent.h>
+#include <pthread.h>
+
+#include "perf_stat.h"
+#include "perf_pmu.h"
+
+/*
+ * PMU registry
+ *
+ * A PMU is read from sysfs the first time one of its events is resolved,
+ * and kept for the rest of the process:
+ *
+ *   type       the perf_event_attr type
+ *   cpumask    only uncore PMUs have one, their events count system-wide
+ *              and are opened on the first CPU listed
+ *   format     fields like "event" in config:0-7 or "umask" in config:8-15,
+ *              a field may map to several bit ranges of config, config1
+ *              or config2
+ *   events     aliases like "event=0x11,umask=0x2", encoded once with the
+ *              format fields and looked up by name in a hash table
+ *
+ * An event is "<pmu>/<alias>" or "<pmu>/<terms>" with terms in the alias
+ * syntax, e.g. "cpu/event=0x3c,umask=0x1/". Lookups after the first one
+ * of a PMU read no file.
+ */
+
+#define PMU_DEVICES		"/sys/bus/event_source/devices"
+#define PMU_PATH_LEN		512
+#define PMU_LINE_LEN		512
+
+static struct perf_pmu *pmus;
+static pthread_mutex_t pmu_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int read_line(const char *path, char *buf, int size)
+{
+	FILE *file;
+	int ok;
+
+	file = fopen(path, "r");
+	if (!file)
+		return ERROR;
+
+	ok = fgets(buf, size, file) != NULL;
+	fclose(file);
+	if (!ok)
+		return ERROR;
+
+	buf[strcspn(buf, "\n")] = '\0';
+
+	return SUCCESS;
+}
+
+static uint32_t hash_name(const char *name)
+{
+	uint32_t hash = 2166136261u;
+
+	for (; *name; name++)
+		hash = (hash ^ (unsigned char)*name) * 16777619u;
+
+	return hash;
+}
+
+static int compare_alias(const void *a, const void *b)
+{
+	return strcmp(((const struct perf_pmu_alias*)a)->name, ((const struct perf_pmu_alias*)b)->name);
+}
+
+// "config1:0-3,8" to a field, ERROR for configs attr does not have here.
+static int parse_field(struct perf_pmu_field *field, char *spec)
+{
+	char *ranges, *range, *save;
+	int lo, hi, n;
+
+	ranges = strchr(spec, ':');
+	if (!ranges || strncmp(spec, "config", 6))
+		return ERROR;
+	*ranges++ = '\0';
+
+	if (!spec[6])
+		field->config = 0;
+	else if (!strcmp(spec + 6, "1"))
+		field->config = 1;
+	else if (!strcmp(spec + 6, "2"))
+		field->config = 2;
+	else
+		return ERROR;
+
+	for (range = strtok_r(ranges, ",", &save); range; range = strtok_r(NULL, ",", &save)) {
+		n = sscanf(range, "%d-%d", &lo, &hi);
+		if (n < 1)
+			return ERROR;
+		if (n == 1)
+			hi = lo;
+		if (lo < 0 || hi > 63 || lo > hi || field->range_num >= MAX_FIELD_RANGES)
+			return ERROR;
+		field->lo[field->range_num] = lo;
+		field->hi[field->range_num] = hi;
+		field->range_num++;
+	}
+
+	return field->range_num ? SUCCESS : ERROR;
+}
+
+static void load_fields(struct perf_pmu *pmu)
+{
+	char path[PMU_PATH_LEN], line[PMU_LINE_LEN];
+	struct perf_pmu_field *field;
+	struct dirent *dent;
+	DIR *dir;
+
+	snprintf(path, sizeof(path), PMU_DEVICES "/%s/format", pmu->name);
+	dir = opendir(path);
+	if (!dir)
+		return;
+
+	while ((dent = readdir(dir))) {
+		if (dent->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), PMU_DEVICES "/%s/format/%s", pmu->name, dent->d_name);
+		if (read_line(path, line, sizeof(line)))
+			continue;
+
+		pmu->fields = realloc(pmu->fields, sizeof(struct perf_pmu_field) * (pmu->field_num + 1));
+		field = &pmu->fields[pmu->field_num];
+		memset(field, 0, sizeof(struct perf_pmu_field));
+		if (parse_field(field, line))
+			continue;
+		field->name = strdup(dent->d_name);
+		pmu->field_num++;
+	}
+
+	closedir(dir);
+}
+
+static void load_aliases(struct perf_pmu *pmu)
+{
+	char path[PMU_PATH_LEN], line[PMU_LINE_LEN];
+	struct perf_pmu_alias *alias;
+	struct dirent *dent;
+	uint32_t slot;
+	DIR *dir;
+
+	snprintf(path, sizeof(path), PMU_DEVICES "/%s/events", pmu->name);
+	dir = opendir(path);
+	if (!dir)
+		return;
+
+	while ((dent = readdir(dir))) {
+		// Skip the .scale and .unit attributes of an event.
+		if (dent->d_name[0] == '.' || strchr(dent->d_name, '.'))
+			continue;
+		snprintf(path, sizeof(path), PMU_DEVICES "/%s/events/%s", pmu->name, dent->d_name);
+		if (read_line(path, line, sizeof(line)))
+			continue;
+
+		pmu->aliases = realloc(pmu->aliases, sizeof(struct perf_pmu_alias) * (pmu->alias_num + 1));
+		alias = &pmu->aliases[pmu->alias_num];
+		memset(alias, 0, sizeof(struct perf_pmu_alias));
+		// Aliases with a term the user must fill in (e.g. "cpu=?") are left out.
+		if (perf_pmu_encode(pmu, line, alias->config))
+			continue;
+		alias->name = strdup(dent->d_name);
+		pmu->alias_num++;
+	}
+
+	closedir(dir);
+
+	qsort(pmu->aliases, pmu->alias_num, sizeof(struct perf_pmu_alias), compare_alias);
+
+	// Open addressing, at most half full.
+	for (pmu->slot_num = 8; pmu->slot_num < pmu->alias_num * 2; pmu->slot_num *= 2)
+		;
+	pmu->slots = malloc(sizeof(int) * pmu->slot_num);
+	memset(pmu->slots, -1, sizeof(int) * pmu->slot_num);
+
+	for (int i = 0; i < pmu->alias_num; i++) {
+		slot = hash_name(pmu->aliases[i].name) & (pmu->slot_num - 1);
+		while (pmu->slots[slot] >= 0)
+			slot = (slot + 1) & (pmu->slot_num - 1);
+		pmu->slots[slot] = i;
+	}
+}
+
+static struct perf_pmu* load_pmu(const char *name)
+{
+	char path[PMU_PATH_LEN], line[PMU_LINE_LEN];
+	struct perf_pmu *pmu;
+
+	pmu = calloc(1, sizeof(struct perf_pmu));
+	pmu->name = strdup(name);
+
+	snprintf(path, sizeof(path), PMU_DEVICES "/%s/type", name);
+	if (strchr(name, '/') || read_line(path, line, sizeof(line))) {
+		pmu->missing = 1;
+		return pmu;
+	}
+
+	pmu->type = strtoul(line, NULL, 0);
+
+	snprintf(path, sizeof(path), PMU_DEVICES "/%s/cpumask", name);
+	pmu->cpu = read_line(path, line, sizeof(line)) ? -1 : atoi(line);
+
+	load_fields(pmu);
+	load_aliases(pmu);
+
+	return pmu;
+}
+
+// The PMU named name, NULL if there is none. Missing PMUs are cached too.
+struct perf_pmu* perf_pmu_find(const char *name)
+{
+	struct perf_pmu *pmu;
+
+	pthread_mutex_lock(&pmu_lock);
+
+	for (pmu = pmus; pmu; pmu = pmu->next)
+		if (!strcmp(pmu->name, name))
+			break;
+
+	if (!pmu) {
+		pmu = load_pmu(name);
+		pmu->next = pmus;
+		pmus = pmu;
+	}
+
+	pthread_mutex_unlock(&pmu_lock);
+
+	return pmu->missing ? NULL : pmu;
+}
+
+struct perf_pmu_alias* perf_pmu_alias(struct perf_pmu *pmu, const char *name)
+{
+	uint32_t slot;
+
+	if (!pmu->slot_num)
+		return NULL;
+
+	slot = hash_name(name) & (pmu->slot_num - 1);
+	for (; pmu->slots[slot] >= 0; slot = (slot + 1) & (pmu->slot_num - 1))
+		if (!strcmp(pmu->aliases[pmu->slots[slot]].name, name))
+			return &pmu->aliases[pmu->slots[slot]];
+
+	return NULL;
+}
+
+// Spread the bits of value over the ranges of the field, lowest range first.
+static void encode_field(struct perf_pmu_field *field, uint64_t value, uint64_t *config)
+{
+	int bit = 0;
+
+	for (int r = 0; r < field->range_num; r++)
+		for (int b = field->lo[r]; b <= field->hi[r]; b++, bit++)
+			if (bit < 64 && (value >> bit) & 1)
+				config[field->config] |= 1ULL << b;
+}
+
+/*
+ * Encode "event=0x11,umask=0x2,any" into config, config1 and config2. A
+ * term without value is 1, config, config1 and config2 set the raw value.
+ */
+int perf_pmu_encode(struct perf_pmu *pmu, const char *terms, uint64_t *config)
+{
+	char buf[PMU_LINE_LEN], *term, *value, *save, *end;
+	struct perf_pmu_field *field;
+	uint64_t num;
+	int k;
+
+	snprintf(buf, sizeof(buf), "%s", terms);
+	memset(config, 0, sizeof(uint64_t) * PMU_CONFIGS);
+
+	for (term = strtok_r(buf, ",", &save); term; term = strtok_r(NULL, ",", &save)) {
+		value = strchr(term, '=');
+		if (value) {
+			*value++ = '\0';
+			num = strtoull(value, &end, 0);
+			if (end == value || *end)
+				return ERROR;
+		} else {
+			num = 1;
+		}
+
+		if (!strcmp(term, "config")) {
+			config[0] = num;
+			continue;
+		}
+		if (!strcmp(term, "config1")) {
+			config[1] = num;
+			continue;
+		}
+		if (!strcmp(term, "config2")) {
+			config[2] = num;
+			continue;
+		}
+
+		field = NULL;
+		for (k = 0; k < pmu->field_num && !field; k++)
+			if (!strcmp(pmu->fields[k].name, term))
+				field = &pmu->fields[k];
+		if (!field)
+			return ERROR;
+
+		encode_field(field, num, config);
+	}
+
+	return SUCCESS;
+}
+
+// Set type and configs of an event from "<pmu>/<alias>" or "<pmu>/<terms>/".
+int perf_pmu_resolve(const char *path, struct perf_event *event)
+{
+	char buf[PMU_LINE_LEN], *name, *end;
+	struct perf_pmu_alias *alias;
+	struct perf_pmu *pmu;
+	uint64_t config[PMU_CONFIGS];
+
+	snprintf(buf, sizeof(buf), "%s", path);
+
+	name = strchr(buf, '/');
+	if (!name)
+		return ERROR;
+	*name++ = '\0';
+
+	end = name + strlen(name);
+	if (end > name && *(end - 1) == '/')
+		*(end - 1) = '\0';
+	if (!*name)
+		return ERROR;
+
+	pmu = perf_pmu_find(buf);
+	if (!pmu)
+		return ERROR;
+
+	alias = perf_pmu_alias(pmu, name);
+	if (alias)
+		memcpy(config, alias->config, sizeof(config));
+	else if (!strchr(name, '=') || perf_pmu_encode(pmu, name, config))
+		return ERROR;
+
+	event->type = pmu->type;
+	event->event_id = config[0];
+	event->config1 = config[1];
+	event->config2 = config[2];
+	event->system_wide = pmu->cpu >= 0;
+	event->sys_cpu = pmu->cpu;
+
+	return SUCCESS;
+}
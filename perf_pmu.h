@@ -0,0 +1,46 @@
+#ifndef __PERF_PMU_H
+#define __PERF_PMU_H
+
+#include <stdint.h>
+
+#include "perf_stat.h"
+
+#define PMU_CONFIGS		3	/* config, config1, config2 */
+#define MAX_FIELD_RANGES	4
+
+// A format field, its bits may be split in several ranges, e.g. config:0-7,32-35.
+struct perf_pmu_field {
+	char *name;
+	int config;
+	int range_num;
+	uint8_t lo[MAX_FIELD_RANGES];
+	uint8_t hi[MAX_FIELD_RANGES];
+};
+
+// An event of the PMU's events directory, encoded with the format fields.
+struct perf_pmu_alias {
+	char *name;
+	uint64_t config[PMU_CONFIGS];
+};
+
+struct perf_pmu {
+	char *name;
+	int missing;
+	uint32_t type;
+	int cpu;			/* first CPU of the cpumask of an uncore PMU, else -1 */
+	struct perf_pmu_field *fields;
+	int field_num;
+	struct perf_pmu_alias *aliases;	/* sorted by name */
+	int alias_num;
+	int *slots;			/* hash of alias names, -1 if empty */
+	int slot_num;
+	struct perf_pmu *next;
+};
+
+/* PMUs of /sys/bus/event_source/devices, loaded once per process */
+struct perf_pmu* perf_pmu_find(const char *name);
+struct perf_pmu_alias* perf_pmu_alias(struct perf_pmu *pmu, const char *name);
+int perf_pmu_encode(struct perf_pmu *pmu, const char *terms, uint64_t *config);
+int perf_pmu_resolve(const char *path, struct perf_event *event);
+
+#endif
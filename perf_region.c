@@ -0,0 +1,336 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "perf_stat.h"
+#include "perf_pmu.h"
+#include "perf_region.h"
+
+/*
+ * Region counting
+ *
+ * Every thread opens one event group on its first region and keeps it
+ * counting until it exits, so entering and leaving a region only reads
+ * the counters: from user space when the PMU allows it, else with one
+ * read of the group. The deltas are added to a table of the thread that
+ * only the thread writes. Tables are pushed on a global list with a
+ * compare and swap, outlive their thread and are summed by name at exit.
+ *
+ * Counts of a region include the regions nested in it. Events must fit
+ * the PMU counters, a group that does not fit never counts.
+ */
+
+#define REGION_MAX_EVENTS	8
+#define REGION_SLOTS		256	/* region names per thread, power of 2 */
+#define REGION_DEPTH		32
+#define REGION_NAME_LEN		24	/* longer names are cut */
+
+struct region_entry {
+	const char *name;		/* published last, NULL while the slot is free */
+	uint64_t calls;
+	uint64_t time;			/* ns */
+	uint64_t counts[REGION_MAX_EVENTS];
+};
+
+struct region_frame {
+	struct region_entry *entry;
+	uint64_t start;
+	uint64_t counts[REGION_MAX_EVENTS];
+};
+
+struct region_thread {
+	struct perf_stat stat;
+	struct region_entry entries[REGION_SLOTS];
+	uint64_t dropped;		/* regions that found no free slot */
+	struct region_frame stack[REGION_DEPTH];
+	int depth;			/* may go past REGION_DEPTH, those are not counted */
+	struct region_thread *next;
+};
+
+static struct perf_event default_events[] = {
+	PERF_EVENT(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cpu-cycles"),
+	PERF_EVENT(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions"),
+	PERF_EVENT(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache-misses"),
+	PERF_EVENT(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch-misses"),
+};
+
+static struct perf_event region_events[REGION_MAX_EVENTS];
+static int region_event_num;
+
+static struct region_thread *region_threads;
+static __thread struct region_thread *region_self;
+static pthread_once_t region_once = PTHREAD_ONCE_INIT;
+static pthread_key_t region_key;
+
+static uint64_t region_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static uint32_t hash_name(const char *name)
+{
+	uint32_t hash = 2166136261u;
+
+	for (; *name; name++)
+		hash = (hash ^ (unsigned char)*name) * 16777619u;
+
+	return hash;
+}
+
+static void region_dump_at_exit()
+{
+	const char *path = getenv("PC_REGION_OUTPUT");
+	FILE *file = path ? fopen(path, "w") : NULL;
+
+	pc_region_dump(file ? file : stderr);
+
+	if (file)
+		fclose(file);
+}
+
+// The counters of a thread stop with it, its table stays for the dump.
+static void region_thread_exit(void *arg)
+{
+	struct region_thread *thread = arg;
+
+	perf_stat_destroy(&thread->stat);
+}
+
+// Sysfs events from PC_REGION_EVENTS, the ones that do not resolve are left out.
+static void region_load_events(char *spec)
+{
+	struct perf_event *event;
+	char *path, *save;
+
+	for (path = strtok_r(spec, " \t\n", &save); path; path = strtok_r(NULL, " \t\n", &save)) {
+		if (region_event_num >= REGION_MAX_EVENTS) {
+			fprintf(stderr, "WARNING: Regions count at most %d events.\n", REGION_MAX_EVENTS);
+			break;
+		}
+		event = &region_events[region_event_num];
+		memset(event, 0, sizeof(struct perf_event));
+		event->event_path = path;
+		event->event_name = strchr(path, '/') ? strchr(path, '/') + 1 : path;
+		if (perf_pmu_resolve(path, event)) {
+			fprintf(stderr, "WARNING: Can not open event: %s\n", path);
+			continue;
+		}
+		// Uncore events can not tell the threads apart.
+		if (event->system_wide) {
+			fprintf(stderr, "WARNING: Regions can not count uncore event: %s\n", path);
+			continue;
+		}
+		// Resolved once, perf_stat_init() of every thread leaves the shared events alone.
+		event->event_path = NULL;
+		region_event_num++;
+	}
+}
+
+static void region_setup()
+{
+	char *spec = getenv("PC_REGION_EVENTS");
+
+	if (spec) {
+		region_load_events(strdup(spec));
+	} else {
+		region_event_num = sizeof(default_events) / sizeof(struct perf_event);
+		memcpy(region_events, default_events, sizeof(default_events));
+	}
+
+	pthread_key_create(&region_key, region_thread_exit);
+	atexit(region_dump_at_exit);
+}
+
+static struct region_thread* region_thread_create()
+{
+	struct region_thread *thread;
+
+	pthread_once(&region_once, region_setup);
+
+	thread = calloc(1, sizeof(struct region_thread));
+	if (!thread)
+		return NULL;
+
+	if (perf_stat_init(&thread->stat, "region", region_events, region_event_num, -1) == SUCCESS &&	\
+	    thread->stat.group_fd >= 0)
+		perf_event_start_group(thread->stat.group_fd);
+
+	do {
+		thread->next = region_threads;
+	} while (!__sync_bool_compare_and_swap(&region_threads, thread->next, thread));
+
+	pthread_setspecific(region_key, thread);
+
+	return thread;
+}
+
+// Running totals of the events, a delta of two reads is the region's count.
+static void region_read(struct region_thread *thread, uint64_t *counts)
+{
+	struct perf_stat *stat = &thread->stat;
+	uint64_t group[MAX_GROUP_EVENTS];
+	int nr = 0, i, j;
+
+	for (i = 0; i < stat->event_num; i++)
+		if (!stat->event_pages[i] || perf_event_read_user(stat->event_pages[i], &counts[i]))
+			break;
+	if (i == stat->event_num)
+		return;
+
+	if (stat->group_fd >= 0)
+		nr = perf_event_read_group(stat->group_fd, group, MAX_GROUP_EVENTS);
+
+	// Same order as perf_stat_end_group(), events that failed to open read 0.
+	for (i = 0, j = 0; i < stat->event_num; i++) {
+		counts[i] = 0;
+		if (stat->event_fds[i] < 0)
+			continue;
+		if (j < nr)
+			counts[i] = group[j];
+		j++;
+	}
+}
+
+static struct region_entry* region_find(struct region_thread *thread, const char *name)
+{
+	struct region_entry *entry;
+	uint32_t slot;
+
+	slot = hash_name(name) & (REGION_SLOTS - 1);
+
+	for (int n = 0; n < REGION_SLOTS; n++, slot = (slot + 1) & (REGION_SLOTS - 1)) {
+		entry = &thread->entries[slot];
+		if (!entry->name) {
+			__atomic_store_n(&entry->name, strndup(name, REGION_NAME_LEN), __ATOMIC_RELEASE);
+			return entry;
+		}
+		if (!strncmp(entry->name, name, REGION_NAME_LEN))
+			return entry;
+	}
+
+	return NULL;
+}
+
+void pc_region_enter(const char *name)
+{
+	struct region_thread *thread = region_self;
+	struct region_frame *frame;
+
+	if (!thread) {
+		thread = region_self = region_thread_create();
+		if (!thread)
+			return;
+	}
+
+	if (thread->depth++ >= REGION_DEPTH)
+		return;
+
+	frame = &thread->stack[thread->depth - 1];
+	frame->entry = region_find(thread, name);
+	if (!frame->entry) {
+		thread->dropped++;
+		return;
+	}
+
+	frame->start = region_now();
+	region_read(thread, frame->counts);
+}
+
+void pc_region_exit(void)
+{
+	struct region_thread *thread = region_self;
+	struct region_frame *frame;
+	struct region_entry *entry;
+	uint64_t counts[REGION_MAX_EVENTS];
+	uint64_t end;
+
+	// An exit without enter is ignored.
+	if (!thread || !thread->depth)
+		return;
+
+	if (thread->depth-- > REGION_DEPTH)
+		return;
+
+	frame = &thread->stack[thread->depth];
+	entry = frame->entry;
+	if (!entry)
+		return;
+
+	// Read in the reverse order of enter, so the counts hug the region.
+	region_read(thread, counts);
+	end = region_now();
+
+	entry->calls++;
+	entry->time += end - frame->start;
+	for (int i = 0; i < thread->stat.event_num; i++)
+		entry->counts[i] += counts[i] - frame->counts[i];
+}
+
+/*
+ * Sum the tables of all threads by region name. Threads still running
+ * may add to their tables meanwhile, their last region is then missing
+ * or partly counted.
+ */
+void pc_region_dump(FILE *file)
+{
+	struct region_entry *sums = NULL, *sum, *entry;
+	struct region_thread *thread;
+	int sum_num = 0, thread_num = 0, k;
+	uint64_t dropped = 0;
+	const char *name;
+
+	for (thread = __atomic_load_n(&region_threads, __ATOMIC_ACQUIRE); thread; thread = thread->next) {
+		thread_num++;
+		dropped += thread->dropped;
+		for (int s = 0; s < REGION_SLOTS; s++) {
+			entry = &thread->entries[s];
+			name = __atomic_load_n(&entry->name, __ATOMIC_ACQUIRE);
+			if (!name || !entry->calls)
+				continue;
+			for (k = 0; k < sum_num && strcmp(sums[k].name, name); k++)
+				;
+			if (k == sum_num) {
+				sums = realloc(sums, sizeof(struct region_entry) * (sum_num + 1));
+				memset(&sums[sum_num], 0, sizeof(struct region_entry));
+				sums[sum_num++].name = name;
+			}
+			sum = &sums[k];
+			sum->calls += entry->calls;
+			sum->time += entry->time;
+			for (int i = 0; i < region_event_num; i++)
+				sum->counts[i] += entry->counts[i];
+		}
+	}
+
+	if (!thread_num)
+		return;
+
+	fprintf(file, "regions of %d threads\n", thread_num);
+	fprintf(file, "-----------------------\n");
+	fprintf(file, "    %-24s  %12s %16s", "", "calls", "time (ms)");
+	for (int i = 0; i < region_event_num; i++)
+		fprintf(file, " %16s", region_events[i].event_name);
+	fprintf(file, "\n");
+
+	for (k = 0; k < sum_num; k++) {
+		fprintf(file, "    %-24s: %12lu %16.3f", sums[k].name, sums[k].calls, (double)sums[k].time / 1000000);
+		for (int i = 0; i < region_event_num; i++)
+			fprintf(file, " %16lu", sums[k].counts[i]);
+		fprintf(file, "\n");
+	}
+
+	fprintf(file, "-----------------------\n");
+	if (dropped)
+		fprintf(file, "    %lu regions not counted, more than %d names in a thread\n", dropped, REGION_SLOTS);
+
+	fflush(file);
+	free(sums);
+}
@@ -0,0 +1,24 @@
+#ifndef __PERF_REGION_H
+#define __PERF_REGION_H
+
+#include <stdio.h>
+
+/*
+ * Named regions to count inside a program, linked with libperfcase:
+ *
+ *   pc_region_enter("decode");
+ *   ...
+ *   pc_region_exit();
+ *
+ * Regions nest and every thread may enter them. Counts are summed per
+ * region name over calls and threads and written at exit, to stderr or
+ * to the file named by PC_REGION_OUTPUT. PC_REGION_EVENTS replaces the
+ * default events with sysfs events, e.g. "armv8_pmuv3_0/l1d_cache_refill
+ * cpu/event=0x3c/", separated by spaces.
+ */
+
+void pc_region_enter(const char *name);
+void pc_region_exit(void);
+void pc_region_dump(FILE *file);
+
+#endif
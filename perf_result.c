@@ -0,0 +1,274 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <math.h>
+
+#include "perf_stat.h"
+#include "perf_case.h"
+#include "perf_sched.h"
+
+/*
+ * Structured results
+ *
+ * One record per case, event group and repeat. JSON writes one object per
+ * line, CSV writes one row per value in long format:
+ *
+ *   case,params,cpu,eventset,group,repeat,kind,name,value,unit
+ *
+ * kind is "time", "event", "overhead", "metric", "series" or "unsupported".
+ * Series rows are the counts read every interval with "-I", the value is
+ * the delta of the interval and the name is "<event>@<ns since start>".
+ * Events the CPU can not count are written once per run as "unsupported"
+ * rows of group -1 with value "n/a" and the reason as unit. Counts of
+ * uncore events are system-wide, their unit is "system-wide" in CSV and
+ * JSON lists them in "system_wide".
+ */
+
+static const char *format_names[] = {
+	[PERF_FORMAT_TEXT] = "text",
+	[PERF_FORMAT_JSON] = "json",
+	[PERF_FORMAT_CSV]  = "csv",
+};
+
+int perf_format_parse(const char *name)
+{
+	int num = sizeof(format_names) / sizeof(char*);
+
+	for (int i = 0; i < num; i++)
+		if (!strcmp(name, format_names[i]))
+			return i;
+
+	return ERROR;
+}
+
+static const char* event_name(struct perf_event *event)
+{
+	return event->event_name ? event->event_name : "unknown";
+}
+
+// Counts stay integers, only metrics carry decimals. Corrected values may be negative.
+static void print_value(FILE *file, double value)
+{
+	fprintf(file, value == floor(value) && fabs(value) < 1e18 ? "%.0f" : "%.6f", value);
+}
+
+static void json_str(FILE *file, const char *str)
+{
+	fputc('"', file);
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\')
+			fprintf(file, "\\%c", *str);
+		else if ((unsigned char)*str < 0x20)
+			fprintf(file, "\\u%04x", *str);
+		else
+			fputc(*str, file);
+	}
+	fputc('"', file);
+}
+
+static void csv_str(FILE *file, const char *str)
+{
+	fputc('"', file);
+	for (; *str; str++) {
+		if (*str == '"')
+			fputc('"', file);
+		fputc(*str, file);
+	}
+	fputc('"', file);
+}
+
+static uint64_t series_delta(struct perf_stat *p_stat, struct perf_result *p_result, int r, int n, int j)
+{
+	uint64_t *counts = p_result->series_counts[r];
+	uint64_t count = counts[n * p_stat->event_num + j];
+	uint64_t prev = n ? counts[(n - 1) * p_stat->event_num + j] : 0;
+
+	return count > prev ? count - prev : 0;
+}
+
+static void json_record(FILE *file, struct perf_run *p_run, int i, int r)
+{
+	struct perf_stat *p_stat = &p_run->stats[i];
+	struct perf_result *p_result = &p_run->results[i];
+	struct perf_metric *metric;
+	int wide_num = 0;
+
+	fprintf(file, "{\"case\":");
+	json_str(file, p_run->p_case->name);
+	fprintf(file, ",\"params\":");
+	json_str(file, p_run->params);
+	fprintf(file, ",\"cpu\":%d,\"eventset\":", p_run->cpu);
+	json_str(file, p_run->eventset);
+	fprintf(file, ",\"group\":%d,\"repeat\":%d", i, r);
+	if (p_stat->thread_num > 1)
+		fprintf(file, ",\"thread\":%d", p_stat->thread_id);
+	if (p_run->iterations)
+		fprintf(file, ",\"iterations\":%d", p_run->iterations);
+	fprintf(file, ",\"duration_ns\":%ld", p_result->durations[r]);
+
+	fprintf(file, ",\"events\":{");
+	for (int j = 0; j < p_stat->event_num; j++) {
+		fprintf(file, "%s", j ? "," : "");
+		json_str(file, event_name(&p_stat->events[j]));
+		fprintf(file, ":%" PRIu64, p_result->counts[r * p_stat->event_num + j]);
+	}
+	fprintf(file, "}");
+
+	for (int j = 0; j < p_stat->event_num; j++) {
+		if (!p_stat->events[j].system_wide)
+			continue;
+		fprintf(file, "%s", wide_num++ ? "," : ",\"system_wide\":[");
+		json_str(file, event_name(&p_stat->events[j]));
+	}
+	if (wide_num)
+		fprintf(file, "]");
+
+	if (p_stat->multiplex) {
+		fprintf(file, ",\"running\":{");
+		for (int j = 0; j < p_stat->event_num; j++) {
+			fprintf(file, "%s", j ? "," : "");
+			json_str(file, event_name(&p_stat->events[j]));
+			fprintf(file, ":%.2f", perf_stat_running(p_stat, j));
+		}
+		fprintf(file, "}");
+	}
+
+	if (p_stat->calibrated) {
+		fprintf(file, ",\"overhead\":{\"duration_ns\":%ld", p_stat->overhead_duration);
+		for (int j = 0; j < p_stat->event_num; j++) {
+			fprintf(file, ",");
+			json_str(file, event_name(&p_stat->events[j]));
+			fprintf(file, ":%" PRIu64, p_stat->overhead_counts[j]);
+		}
+		fprintf(file, "}");
+	}
+
+	fprintf(file, ",\"metrics\":{");
+	for (int k = 0; k < p_result->metric_num; k++) {
+		metric = &p_result->metrics[r * MAX_STAT_METRICS + k];
+		fprintf(file, "%s", k ? "," : "");
+		json_str(file, metric->name);
+		fprintf(file, ":{\"value\":");
+		print_value(file, metric->value);
+		fprintf(file, ",\"unit\":");
+		json_str(file, metric->unit);
+		fprintf(file, "}");
+	}
+	fprintf(file, "}");
+
+	// Columns of the interval series, counts are deltas like in CSV.
+	if (p_result->series_num) {
+		fprintf(file, ",\"series\":{\"time_ns\":[");
+		for (int n = 0; n < p_result->series_num[r]; n++)
+			fprintf(file, "%s%ld", n ? "," : "", p_result->series_times[r][n]);
+		fprintf(file, "]");
+		for (int j = 0; j < p_stat->event_num; j++) {
+			fprintf(file, ",");
+			json_str(file, event_name(&p_stat->events[j]));
+			fprintf(file, ":[");
+			for (int n = 0; n < p_result->series_num[r]; n++)
+				fprintf(file, "%s%" PRIu64, n ? "," : "", series_delta(p_stat, p_result, r, n, j));
+			fprintf(file, "]");
+		}
+		fprintf(file, "}");
+	}
+
+	if (p_run->supported_num < p_run->event_num) {
+		fprintf(file, ",\"unsupported\":{");
+		for (int j = p_run->supported_num; j < p_run->event_num; j++) {
+			fprintf(file, "%s", j > p_run->supported_num ? "," : "");
+			json_str(file, event_name(&p_run->events[j]));
+			fprintf(file, ":");
+			json_str(file, perf_event_status_name(p_run->event_status[j]));
+		}
+		fprintf(file, "}");
+	}
+	fprintf(file, "}\n");
+}
+
+static void csv_key(FILE *file, struct perf_run *p_run, int i, int r, const char *kind, const char *name)
+{
+	csv_str(file, p_run->p_case->name);
+	fputc(',', file);
+	csv_str(file, p_run->params);
+	fprintf(file, ",%d,", p_run->cpu);
+	csv_str(file, p_run->eventset);
+	fprintf(file, ",%d,%d,%s,", i, r, kind);
+	csv_str(file, name);
+	fputc(',', file);
+}
+
+static void csv_row(FILE *file, struct perf_run *p_run, int i, int r, const char *kind, const char *name, double value, const char *unit)
+{
+	csv_key(file, p_run, i, r, kind, name);
+	print_value(file, value);
+	fputc(',', file);
+	csv_str(file, unit);
+	fputc('\n', file);
+}
+
+static void csv_unsupported(FILE *file, struct perf_run *p_run)
+{
+	for (int j = p_run->supported_num; j < p_run->event_num; j++) {
+		csv_key(file, p_run, -1, 0, "unsupported", event_name(&p_run->events[j]));
+		fprintf(file, "n/a,");
+		csv_str(file, perf_event_status_name(p_run->event_status[j]));
+		fputc('\n', file);
+	}
+}
+
+static void csv_record(FILE *file, struct perf_run *p_run, int i, int r)
+{
+	struct perf_stat *p_stat = &p_run->stats[i];
+	struct perf_result *p_result = &p_run->results[i];
+	struct perf_metric *metric;
+	char name[64];
+
+	csv_row(file, p_run, i, r, "time", "duration", p_result->durations[r], "ns");
+
+	for (int j = 0; j < p_stat->event_num; j++)
+		csv_row(file, p_run, i, r, "event", event_name(&p_stat->events[j]),	\
+			p_result->counts[r * p_stat->event_num + j],			\
+			p_stat->events[j].system_wide ? "system-wide" : "");
+
+	if (p_stat->calibrated) {
+		csv_row(file, p_run, i, r, "overhead", "duration", p_stat->overhead_duration, "ns");
+		for (int j = 0; j < p_stat->event_num; j++)
+			csv_row(file, p_run, i, r, "overhead", event_name(&p_stat->events[j]),	\
+				p_stat->overhead_counts[j], "");
+	}
+
+	for (int k = 0; k < p_result->metric_num; k++) {
+		metric = &p_result->metrics[r * MAX_STAT_METRICS + k];
+		csv_row(file, p_run, i, r, "metric", metric->name, metric->value, metric->unit);
+	}
+
+	for (int n = 0; p_result->series_num && n < p_result->series_num[r]; n++) {
+		for (int j = 0; j < p_stat->event_num; j++) {
+			snprintf(name, sizeof(name), "%s@%ld", event_name(&p_stat->events[j]), p_result->series_times[r][n]);
+			csv_row(file, p_run, i, r, "series", name, series_delta(p_stat, p_result, r, n, j), "");
+		}
+	}
+}
+
+void perf_result_write(FILE *file, struct perf_run *p_run, int format, int header)
+{
+	if (format == PERF_FORMAT_CSV && header)
+		fprintf(file, "case,params,cpu,eventset,group,repeat,kind,name,value,unit\n");
+
+	for (int i = 0; i < p_run->stat_num; i++) {
+		for (int r = 0; r < p_run->repeat; r++) {
+			if (format == PERF_FORMAT_JSON)
+				json_record(file, p_run, i, r);
+			else if (format == PERF_FORMAT_CSV)
+				csv_record(file, p_run, i, r);
+		}
+	}
+
+	if (format == PERF_FORMAT_CSV)
+		csv_unsupported(file, p_run);
+
+	fflush(file);
+}
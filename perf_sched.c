@@ -0,0 +1,508 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <sched.h>
+#include <unistd.h>
+#include <errno.h>
+#include <glob.h>
+
+#include "perf_stat.h"
+#include "perf_cpu.h"
+#include "perf_sched.h"
+#include "perf_pmu.h"
+#include "arch/arm_pmuv3.h"
+
+/*
+ * Event scheduler
+ *
+ * The number of counters is probed per CPU: groups of one more event are
+ * opened until one is refused or does not count, then a group of that size
+ * plus a cycles event tells whether cycles have a dedicated counter.
+ *
+ * Events are then packed into the fewest groups. Every cycles event starts
+ * a group (ratios are normalized by the cycles of the same group) and takes
+ * an instructions event if there is one. Related events, by the longest
+ * shared "_", "-" or ":" prefix (e.g. l1d_cache and l1d_cache_refill), are kept
+ * together and placed largest cluster first. Software events are free and
+ * join the first group counting per task. Sysfs events of the CPU's core
+ * PMU count on the same counters as raw events. Events of another PMU
+ * (uncore) only share a group with events of the same PMU.
+ *
+ * Before that every event is opened once on its own. Events the kernel
+ * refuses are unsupported, or need privilege when refused with EACCES or
+ * EPERM. Arm raw events open even when the core does not implement them,
+ * so common events are also checked against the PMU events in sysfs, which
+ * only lists the events PMCEID reports as implemented.
+ */
+
+#define PROBE_LOOPS		100000
+
+#if defined(__aarch64__)
+#define PROBE_TYPE		PERF_TYPE_RAW
+#define PROBE_EVENT		ARMV8_PMUV3_PERFCTR_INST_RETIRED
+#else
+#define PROBE_TYPE		PERF_TYPE_HARDWARE
+#define PROBE_EVENT		PERF_COUNT_HW_BRANCH_INSTRUCTIONS
+#endif
+
+// Raw cycles and instructions, also the config of the core PMU's sysfs events.
+#if defined(__aarch64__)
+#define RAW_CYCLES		ARMV8_PMUV3_PERFCTR_CPU_CYCLES
+#define RAW_INSTRUCTIONS	ARMV8_PMUV3_PERFCTR_INST_RETIRED
+#elif defined(__x86_64__) || defined(__i386__)
+#define RAW_CYCLES		0x3c
+#define RAW_INSTRUCTIONS	0xc0
+#endif
+
+#define COMMON_EVENTS		0x10000
+#define PMU_DEVICES		"/sys/bus/event_source/devices"
+
+#define CLASS_CORE		0
+#define CLASS_FREE		-1
+
+struct sched_group {
+	int class;
+	int used;
+	int cap;
+	int cycles;
+};
+
+static struct perf_sched_caps probed_caps[MAX_CPUS];
+
+static struct perf_event probe_event = PERF_EVENT(PROBE_TYPE, PROBE_EVENT, "probe");
+static struct perf_event cycles_event = PERF_EVENT(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cpu-cycles");
+
+static const char *status_names[] = {
+	[PERF_EVENT_SUPPORTED]   = "supported",
+	[PERF_EVENT_UNSUPPORTED] = "unsupported",
+	[PERF_EVENT_NOPERM]      = "no permission",
+};
+
+static void probe_workload()
+{
+	volatile int sum = 0;
+
+	for (int i = 0; i < PROBE_LOOPS; i++)
+		sum += i & 1 ? 1 : 2;
+}
+
+// Open num probe events (and a cycles event) as a group, 1 if all of them count.
+static int probe_group(int cpu, int num, int cycles)
+{
+	uint64_t counts[MAX_GROUP_EVENTS];
+	int fds[MAX_GROUP_EVENTS];
+	int fd, fd_num = 0, group_fd = -1, ok = 0;
+
+	for (int i = 0; i < num + cycles; i++) {
+		if (i < num)
+			fd = perf_event_open_group(&probe_event, 0, cpu, group_fd);
+		else
+			fd = perf_event_open_group(&cycles_event, 0, cpu, group_fd);
+		if (fd < 0)
+			goto EXIT;
+		if (group_fd < 0)
+			group_fd = fd;
+		fds[fd_num++] = fd;
+	}
+
+	perf_event_reset_group(group_fd);
+	perf_event_start_group(group_fd);
+	probe_workload();
+	perf_event_stop_group(group_fd);
+
+	if (perf_event_read_group(group_fd, counts, fd_num) != fd_num)
+		goto EXIT;
+
+	ok = 1;
+	for (int i = 0; i < fd_num; i++)
+		if (!counts[i])
+			ok = 0;
+
+EXIT:
+	for (int i = 0; i < fd_num; i++)
+		perf_event_close(fds[i]);
+
+	return ok;
+}
+
+// Probed once per CPU, falls back to MAX_PERF_EVENTS counters if nothing counts.
+int perf_sched_probe(int cpu, struct perf_sched_caps *caps)
+{
+	cpu_set_t saved, mask;
+	int num;
+
+	if (cpu >= 0 && cpu < MAX_CPUS && probed_caps[cpu].probed) {
+		*caps = probed_caps[cpu];
+		return caps->counters ? SUCCESS : ERROR;
+	}
+
+	memset(caps, 0, sizeof(struct perf_sched_caps));
+
+	// The probe counts its own loop, which has to run on the probed CPU.
+	sched_getaffinity(0, sizeof(saved), &saved);
+	if (cpu >= 0) {
+		CPU_ZERO(&mask);
+		CPU_SET(cpu, &mask);
+		sched_setaffinity(0, sizeof(mask), &mask);
+	}
+
+	for (num = 1; num < MAX_GROUP_EVENTS && probe_group(cpu, num, 0); num++)
+		;
+	caps->counters = num - 1;
+	if (caps->counters)
+		caps->fixed_cycles = probe_group(cpu, caps->counters, 1);
+
+	sched_setaffinity(0, sizeof(saved), &saved);
+
+	caps->probed = 1;
+	if (cpu >= 0 && cpu < MAX_CPUS)
+		probed_caps[cpu] = *caps;
+
+	if (!caps->counters) {
+		caps->counters = MAX_PERF_EVENTS;
+		return ERROR;
+	}
+
+	return SUCCESS;
+}
+
+const char* perf_event_status_name(int status)
+{
+	return status_names[status];
+}
+
+// The core PMU of the CPU, the only one of its kind when the topology has none.
+static struct perf_pmu* core_pmu(int cpu)
+{
+	struct perf_cpu info;
+	struct perf_pmu *pmu = NULL;
+
+	perf_cpu_topology(cpu < 0 ? 0 : cpu, &info);
+	if (strcmp(info.pmu, "-"))
+		return perf_pmu_find(info.pmu);
+
+#if defined(__aarch64__)
+	glob_t paths;
+
+	if (!glob(PMU_DEVICES "/armv8*", 0, NULL, &paths)) {
+		pmu = perf_pmu_find(strrchr(paths.gl_pathv[0], '/') + 1);
+		globfree(&paths);
+	}
+#else
+	pmu = perf_pmu_find("cpu");
+#endif
+
+	return pmu;
+}
+
+#if defined(__aarch64__)
+/*
+ * Common event numbers (0x0-0x3f, 0x4000-0x403f) the core PMU of the CPU
+ * lists in sysfs, loaded once. Returns NULL if the PMU has no events there.
+ */
+static const uint8_t* common_events(int cpu)
+{
+	static uint8_t *events[MAX_CPUS];
+	static int loaded[MAX_CPUS];
+	struct perf_pmu *pmu;
+	uint64_t id;
+
+	if (cpu < 0 || cpu >= MAX_CPUS)
+		return NULL;
+	if (loaded[cpu])
+		return events[cpu];
+	loaded[cpu] = 1;
+
+	pmu = core_pmu(cpu);
+	if (!pmu || !pmu->alias_num)
+		return NULL;
+
+	events[cpu] = calloc(COMMON_EVENTS / 8, 1);
+	for (int i = 0; i < pmu->alias_num; i++) {
+		id = pmu->aliases[i].config[0];
+		if (id < COMMON_EVENTS)
+			events[cpu][id / 8] |= 1 << (id % 8);
+	}
+
+	return events[cpu];
+}
+#endif
+
+int perf_sched_probe_event(struct perf_event *event, int cpu)
+{
+	int fd;
+
+	// A sysfs event the PMU registry does not know.
+	if (event->event_path && perf_pmu_resolve(event->event_path, event))
+		return PERF_EVENT_UNSUPPORTED;
+
+	fd = perf_event_open(event, cpu);
+	if (fd < 0)
+		return errno == EACCES || errno == EPERM ? PERF_EVENT_NOPERM : PERF_EVENT_UNSUPPORTED;
+	perf_event_close(fd);
+
+#if defined(__aarch64__)
+	const uint8_t *common = common_events(cpu);
+	uint64_t id = event->event_id;
+
+	if (common && event->type == PERF_TYPE_RAW && (id < 0x40 || (id >= 0x4000 && id < 0x4040)))
+		if (!(common[id / 8] & (1 << (id % 8))))
+			return PERF_EVENT_UNSUPPORTED;
+#endif
+
+	return PERF_EVENT_SUPPORTED;
+}
+
+/*
+ * Copy the supported events to filtered followed by the others, with the
+ * status of each in status. Returns the number of supported events.
+ */
+int perf_sched_filter(struct perf_event *events, int event_num, int cpu, struct perf_event *filtered, int *status)
+{
+	int *probed, num = 0, k;
+
+	probed = malloc(sizeof(int) * event_num);
+
+	perf_stat_init_events(events, event_num);
+	for (int i = 0; i < event_num; i++)
+		probed[i] = perf_sched_probe_event(&events[i], cpu);
+
+	for (int i = 0; i < event_num; i++)
+		if (probed[i] == PERF_EVENT_SUPPORTED)
+			filtered[num++] = events[i];
+
+	k = num;
+	for (int i = 0; i < event_num; i++) {
+		if (probed[i] == PERF_EVENT_SUPPORTED)
+			continue;
+		status[k] = probed[i];
+		filtered[k++] = events[i];
+	}
+	for (int i = 0; i < num; i++)
+		status[i] = PERF_EVENT_SUPPORTED;
+
+	free(probed);
+
+	return num;
+}
+
+// Raw events and sysfs events of the core PMU (core_type) take the same configs.
+static int is_core_raw(struct perf_event *event, int core_type)
+{
+	return event->type == PERF_TYPE_RAW || (core_type >= 0 && event->type == core_type);
+}
+
+static int is_cycles(struct perf_event *event, int core_type)
+{
+	if (event->type == PERF_TYPE_HARDWARE && event->event_id == PERF_COUNT_HW_CPU_CYCLES)
+		return 1;
+#if defined(RAW_CYCLES)
+	if (is_core_raw(event, core_type) && event->event_id == RAW_CYCLES)
+		return 1;
+#endif
+	return 0;
+}
+
+static int is_instructions(struct perf_event *event, int core_type)
+{
+	if (event->type == PERF_TYPE_HARDWARE && event->event_id == PERF_COUNT_HW_INSTRUCTIONS)
+		return 1;
+#if defined(RAW_INSTRUCTIONS)
+	if (is_core_raw(event, core_type) && event->event_id == RAW_INSTRUCTIONS)
+		return 1;
+#endif
+	return 0;
+}
+
+// Core PMU events share counters, software events take none, others have their own PMU.
+static int event_class(struct perf_event *event, int core_type)
+{
+	switch (event->type) {
+	case PERF_TYPE_HARDWARE:
+	case PERF_TYPE_HW_CACHE:
+	case PERF_TYPE_RAW:
+		return CLASS_CORE;
+	case PERF_TYPE_SOFTWARE:
+	case PERF_TYPE_TRACEPOINT:
+		return CLASS_FREE;
+	default:
+		return event->type == core_type ? CLASS_CORE : event->type;
+	}
+}
+
+static int name_end(char c)
+{
+	return c == '_' || c == '-' || c == ':' || !c;
+}
+
+// Length of the longest common prefix of a and b that ends a word of both.
+static int shared_prefix(const char *a, const char *b)
+{
+	int len = 0;
+
+	for (int i = 0; a[i] && a[i] == b[i]; i++)
+		if (name_end(a[i + 1]) && name_end(b[i + 1]))
+			len = i + 1;
+
+	return len;
+}
+
+static int find_root(int *parent, int i)
+{
+	while (parent[i] != i)
+		i = parent[i] = parent[parent[i]];
+	return i;
+}
+
+static int new_group(struct sched_group *groups, int *group_num, int class, struct perf_sched_caps *caps)
+{
+	struct sched_group *group = &groups[(*group_num)++];
+
+	group->class = class;
+	group->used = 0;
+	group->cap = class == CLASS_CORE ? caps->counters : MAX_PERF_EVENTS;
+	group->cycles = 0;
+
+	return *group_num - 1;
+}
+
+static void place(struct sched_group *groups, int g, int *group_of, int i, int cost)
+{
+	groups[g].used += cost;
+	group_of[i] = g;
+}
+
+/*
+ * Reorder events into packed, one group after another, and return the
+ * number of groups with the size of each in sizes. Both arrays hold
+ * event_num entries.
+ */
+int perf_sched_pack(struct perf_event *events, int event_num, int cpu, struct perf_event *packed, int *sizes)
+{
+	struct perf_sched_caps caps;
+	struct sched_group *groups;
+	int *group_of, *parent, *size, *order;
+	int group_num = 0, order_num = 0, best, len, class, g, n, k, placed;
+	struct perf_pmu *pmu;
+	int core_type;
+
+	perf_stat_init_events(events, event_num);
+	perf_sched_probe(cpu, &caps);
+
+	pmu = core_pmu(cpu);
+	core_type = pmu ? pmu->type : -1;
+
+	groups = calloc(event_num, sizeof(struct sched_group));
+	group_of = malloc(sizeof(int) * event_num);
+	parent = malloc(sizeof(int) * event_num);
+	size = calloc(event_num, sizeof(int));
+	order = malloc(sizeof(int) * event_num);
+
+	for (int i = 0; i < event_num; i++) {
+		group_of[i] = -1;
+		parent[i] = i;
+	}
+
+	/* every cycles event opens a group */
+	for (int i = 0; i < event_num; i++) {
+		if (!is_cycles(&events[i], core_type))
+			continue;
+		g = new_group(groups, &group_num, CLASS_CORE, &caps);
+		groups[g].cycles = 1;
+		place(groups, g, group_of, i, caps.fixed_cycles ? 0 : 1);
+	}
+
+	/* instructions go with the cycles for IPC, one per cycles group */
+	for (int i = 0, g = 0; i < event_num && g < group_num; i++) {
+		if (!is_instructions(&events[i], core_type) || groups[g].used >= groups[g].cap)
+			continue;
+		place(groups, g++, group_of, i, 1);
+	}
+
+	/* join each event with the events it shares the longest prefix with */
+	for (int i = 0; i < event_num; i++) {
+		if (group_of[i] >= 0 || event_class(&events[i], core_type) == CLASS_FREE || !events[i].event_name)
+			continue;
+		best = 0;
+		for (int j = 0; j < event_num; j++) {
+			if (j == i || group_of[j] >= 0 || !events[j].event_name)
+				continue;
+			if (event_class(&events[j], core_type) != event_class(&events[i], core_type))
+				continue;
+			len = shared_prefix(events[i].event_name, events[j].event_name);
+			if (len > best)
+				best = len;
+		}
+		for (int j = 0; j < event_num && best; j++) {
+			if (j == i || group_of[j] >= 0 || !events[j].event_name)
+				continue;
+			if (event_class(&events[j], core_type) != event_class(&events[i], core_type))
+				continue;
+			if (shared_prefix(events[i].event_name, events[j].event_name) == best)
+				parent[find_root(parent, j)] = find_root(parent, i);
+		}
+	}
+
+	/* clusters by size, largest first, in order of appearance */
+	for (int i = 0; i < event_num; i++)
+		if (group_of[i] < 0 && event_class(&events[i], core_type) != CLASS_FREE)
+			size[find_root(parent, i)]++;
+	for (int s = event_num; s > 0; s--)
+		for (int i = 0; i < event_num; i++)
+			if (size[i] == s)
+				order[order_num++] = i;
+
+	for (int c = 0; c < order_num; c++) {
+		n = size[order[c]];
+		class = event_class(&events[order[c]], core_type);
+
+		/* first group with room for the whole cluster, or new ones */
+		for (g = 0; g < group_num; g++)
+			if (groups[g].class == class && groups[g].cap - groups[g].used >= n)
+				break;
+		if (g == group_num)
+			g = new_group(groups, &group_num, class, &caps);
+
+		for (int i = 0; i < event_num; i++) {
+			if (group_of[i] >= 0 || event_class(&events[i], core_type) == CLASS_FREE || find_root(parent, i) != order[c])
+				continue;
+			if (groups[g].used >= groups[g].cap)
+				g = new_group(groups, &group_num, class, &caps);
+			place(groups, g, group_of, i, 1);
+		}
+	}
+
+	/* software events count without a counter, with the first per-task group */
+	for (g = 0; g < group_num; g++) {
+		for (k = 0; k < event_num && !(group_of[k] == g && events[k].system_wide); k++)
+			;
+		if (k == event_num)
+			break;
+	}
+	for (int i = 0; i < event_num; i++) {
+		if (group_of[i] >= 0)
+			continue;
+		if (g == group_num)
+			new_group(groups, &group_num, CLASS_CORE, &caps);
+		place(groups, g, group_of, i, 0);
+	}
+
+	for (g = 0, k = 0; g < group_num; g++) {
+		placed = 0;
+		for (int i = 0; i < event_num; i++)
+			if (group_of[i] == g)
+				packed[k + placed++] = events[i];
+		sizes[g] = placed;
+		k += placed;
+	}
+
+	free(order);
+	free(size);
+	free(parent);
+	free(group_of);
+	free(groups);
+
+	return group_num;
+}
@@ -0,0 +1,28 @@
+#ifndef __PERF_SCHED_H
+#define __PERF_SCHED_H
+
+#include "perf_stat.h"
+
+// What the core PMU of a CPU co-schedules in one group.
+struct perf_sched_caps {
+	int counters;			/* general purpose counters */
+	int fixed_cycles;		/* cycles have a dedicated counter */
+	int probed;
+};
+
+enum perf_event_status {
+	PERF_EVENT_SUPPORTED,
+	PERF_EVENT_UNSUPPORTED,
+	PERF_EVENT_NOPERM,
+};
+
+/* pack events into groups that fit the counters */
+int perf_sched_probe(int cpu, struct perf_sched_caps *caps);
+int perf_sched_pack(struct perf_event *events, int event_num, int cpu, struct perf_event *packed, int *sizes);
+
+/* probe which events the CPU can count */
+int perf_sched_probe_event(struct perf_event *event, int cpu);
+int perf_sched_filter(struct perf_event *events, int event_num, int cpu, struct perf_event *filtered, int *status);
+const char* perf_event_status_name(int status);
+
+#endif
@@ -1,32 +1,101 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/syscall.h>
+#include <sched.h>
+#include <errno.h>
 
 #include "perf_stat.h"
+#include "perf_summary.h"
+#include "perf_pmu.h"
 
 int __perf_event_open(struct perf_event_attr *attr, pid_t pid, int cpu, int group_fd, unsigned long flags)
 {
 	return syscall(__NR_perf_event_open, attr, pid, cpu, group_fd, flags);
 }
 
-int perf_event_open(uint32_t type, uint64_t event_id, int cpu)
+static int __perf_event_open_attr(struct perf_event *event, pid_t pid, int cpu, int group_fd, uint64_t read_format)
 {
 	struct perf_event_attr attr;
 
 	memset(&attr, 0, sizeof(struct perf_event_attr));
 
 	attr.size = sizeof(struct perf_event_attr);
-	attr.type = type;
-	attr.config = event_id;
+	attr.type = event->type;
+	attr.config = event->event_id;
+	attr.config1 = event->config1;
+	attr.config2 = event->config2;
 	attr.disabled = 1;
+	attr.read_format = read_format;
+	attr.exclude_kernel = event->priv == PERF_PRIV_USER;
+	attr.exclude_hv = event->priv == PERF_PRIV_USER;
+	attr.exclude_user = event->priv == PERF_PRIV_KERNEL;
+	// Another task is counted with the threads and children it starts later.
+	attr.inherit = pid > 0;
+
+#if defined(__aarch64__)
+	// config1:1 asks the arm_pmuv3 driver for EL0 counter read access
+	if (event->type == PERF_TYPE_RAW || event->type == PERF_TYPE_HARDWARE)
+		attr.config1 |= 0x2;
+#endif
 
 	//printf("type=%d, event=0x%llx, size=%d\n", attr.type, attr.config, attr.size);
 
-	// see perf_event_open(2) pid and cpu
-	return __perf_event_open(&attr, cpu < 0 ? 0 : -1, cpu, -1, PERF_FLAG_FD_CLOEXEC);
+	/*
+	 * see perf_event_open(2) pid and cpu. Core events count task pid (the
+	 * calling thread if 0) while it runs on cpu (any cpu if -1). Uncore
+	 * PMUs have no task context, they count every task and must be opened
+	 * on the CPU of their cpumask.
+	 */
+	if (event->system_wide)
+		return __perf_event_open(&attr, -1, event->sys_cpu, group_fd, PERF_FLAG_FD_CLOEXEC);
+
+	return __perf_event_open(&attr, pid, cpu, group_fd, PERF_FLAG_FD_CLOEXEC);
+}
+
+int perf_event_open(struct perf_event *event, int cpu)
+{
+	return __perf_event_open_attr(event, 0, cpu, -1, 0);
+}
+
+// Open an event as a member of group_fd's group, or as a new leader if group_fd < 0.
+int perf_event_open_group(struct perf_event *event, pid_t pid, int cpu, int group_fd)
+{
+	return __perf_event_open_attr(event, pid, cpu, group_fd, PERF_FORMAT_GROUP);
+}
+
+// Open a standalone event which reports enabled/running time for multiplexing.
+int perf_event_open_scaled(struct perf_event *event, pid_t pid, int cpu)
+{
+	return __perf_event_open_attr(event, pid, cpu, -1,
+		PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING);
+}
+
+// Open a user space sampling event of the calling thread with IP, TID and TIME in each sample.
+int perf_event_open_sampling(struct perf_event *event, int cpu, uint64_t period)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(struct perf_event_attr));
+
+	attr.size = sizeof(struct perf_event_attr);
+	attr.type = event->type;
+	attr.config = event->event_id;
+	attr.config1 = event->config1;
+	attr.config2 = event->config2;
+	attr.disabled = 1;
+	attr.sample_period = period;
+	attr.sample_type = PERF_SAMPLE_IP | PERF_SAMPLE_TID | PERF_SAMPLE_TIME;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	// Only the calling thread is sampled, on cpu or on any cpu if -1.
+	return __perf_event_open(&attr, 0, cpu, -1, PERF_FLAG_FD_CLOEXEC);
 }
 
 int perf_event_start(int fd)
@@ -39,6 +108,21 @@ int perf_event_stop(int fd)
 	return ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
 }
 
+int perf_event_reset_group(int group_fd)
+{
+	return ioctl(group_fd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+}
+
+int perf_event_start_group(int group_fd)
+{
+	return ioctl(group_fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+int perf_event_stop_group(int group_fd)
+{
+	return ioctl(group_fd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+}
+
 uint64_t perf_event_read(int fd)
 {
 	int ret;
@@ -51,17 +135,180 @@ uint64_t perf_event_read(int fd)
 	return count;
 }
 
+// Read the raw count of a scaled event with its enabled/running time.
+uint64_t perf_event_read_scaled(int fd, uint64_t *enabled, uint64_t *running)
+{
+	uint64_t buf[3];
+	int ret;
+
+	ret = read(fd, buf, sizeof(buf));
+	if (ret < (int)sizeof(buf)) {
+		*enabled = *running = 0;
+		return 0;
+	}
+
+	*enabled = buf[1];
+	*running = buf[2];
+	return buf[0];
+}
+
+// Read all counts of a group in one syscall, returns the number of counts read.
+int perf_event_read_group(int group_fd, uint64_t *counts, int count_num)
+{
+	uint64_t buf[1 + MAX_GROUP_EVENTS];
+	int ret, nr;
+
+	ret = read(group_fd, buf, sizeof(buf));
+	if (ret < (int)sizeof(uint64_t))
+		return 0;
+
+	nr = buf[0] < count_num ? buf[0] : count_num;
+	memcpy(counts, &buf[1], sizeof(uint64_t) * nr);
+
+	return nr;
+}
+
 int perf_event_close(int fd)
 {
 	return close(fd);
 }
 
+/*
+ * User space counter reads
+ *
+ * The kernel publishes which hardware counter an event lives on in the
+ * event's perf_event_mmap_page. When user access is granted the counter
+ * can be read directly with mrs/rdpmc, without any syscall.
+ */
+
+#if defined(__aarch64__)
+#define PMEVCNTR_CASE(n)							\
+	case n:									\
+		__asm__ volatile("mrs %0, pmevcntr" #n "_el0" : "=r" (val));	\
+		break;
+
+static uint64_t __read_pmc(uint32_t counter)
+{
+	uint64_t val = 0;
+
+	switch (counter) {
+	PMEVCNTR_CASE(0)  PMEVCNTR_CASE(1)  PMEVCNTR_CASE(2)  PMEVCNTR_CASE(3)
+	PMEVCNTR_CASE(4)  PMEVCNTR_CASE(5)  PMEVCNTR_CASE(6)  PMEVCNTR_CASE(7)
+	PMEVCNTR_CASE(8)  PMEVCNTR_CASE(9)  PMEVCNTR_CASE(10) PMEVCNTR_CASE(11)
+	PMEVCNTR_CASE(12) PMEVCNTR_CASE(13) PMEVCNTR_CASE(14) PMEVCNTR_CASE(15)
+	PMEVCNTR_CASE(16) PMEVCNTR_CASE(17) PMEVCNTR_CASE(18) PMEVCNTR_CASE(19)
+	PMEVCNTR_CASE(20) PMEVCNTR_CASE(21) PMEVCNTR_CASE(22) PMEVCNTR_CASE(23)
+	PMEVCNTR_CASE(24) PMEVCNTR_CASE(25) PMEVCNTR_CASE(26) PMEVCNTR_CASE(27)
+	PMEVCNTR_CASE(28) PMEVCNTR_CASE(29) PMEVCNTR_CASE(30)
+	case 31:
+		// the cycle counter is published as index 32
+		__asm__ volatile("mrs %0, pmccntr_el0" : "=r" (val));
+		break;
+	}
+
+	return val;
+}
+#define HAVE_READ_PMC
+#elif defined(__x86_64__) || defined(__i386__)
+static uint64_t __read_pmc(uint32_t counter)
+{
+	uint32_t low, high;
+
+	__asm__ volatile("rdpmc" : "=a" (low), "=d" (high) : "c" (counter));
+
+	return low | ((uint64_t)high << 32);
+}
+#define HAVE_READ_PMC
+#endif
+
+/*
+ * User space access is a system-wide setting left to the admin, it is only
+ * read here. When it is off, counts fall back to the read() syscall. The
+ * warning goes to stderr, stdout may be the records or a host program's.
+ */
+static void perf_event_check_user_access()
+{
+	const char *path;
+	char value = 0;
+	FILE *file;
+
+#if defined(__aarch64__)
+	path = "/proc/sys/kernel/perf_user_access";
+#elif defined(__x86_64__) || defined(__i386__)
+	path = "/sys/bus/event_source/devices/cpu/rdpmc";
+#else
+	path = NULL;
+#endif
+	file = path ? fopen(path, "r") : NULL;
+	if (!file)
+		return;
+
+	if (fread(&value, 1, 1, file) == 1 && value == '0')
+		fprintf(stderr, "WARNING: User space counter reads are off (%s), counts are read with syscalls.\n", path);
+	fclose(file);
+}
+
+static pthread_once_t user_access_once = PTHREAD_ONCE_INIT;
+
+struct perf_event_mmap_page* perf_event_map_user(int fd)
+{
+	void *page;
+
+	pthread_once(&user_access_once, perf_event_check_user_access);
+
+	page = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd, 0);
+	if (page == MAP_FAILED)
+		return NULL;
+
+	return (struct perf_event_mmap_page*)page;
+}
+
+void perf_event_unmap_user(struct perf_event_mmap_page *page)
+{
+	munmap(page, sysconf(_SC_PAGESIZE));
+}
+
+// Read an event count from user space, fails if the counter is not accessible.
+int perf_event_read_user(struct perf_event_mmap_page *page, uint64_t *count)
+{
+#ifdef HAVE_READ_PMC
+	uint32_t seq, idx;
+	uint64_t val, pmc;
+	int width;
+
+	do {
+		seq = page->lock;
+		__sync_synchronize();
+
+		idx = page->index;
+		if (!page->cap_user_rdpmc || !idx)
+			return ERROR;
+
+		val = page->offset;
+		width = page->pmc_width;
+		pmc = __read_pmc(idx - 1);
+
+		// the hardware counter is pmc_width bits wide, sign extend it
+		pmc <<= 64 - width;
+		val += (uint64_t)((int64_t)pmc >> (64 - width));
+
+		__sync_synchronize();
+	} while (page->lock != seq);
+
+	*count = val;
+	return SUCCESS;
+#else
+	return ERROR;
+#endif
+}
+
 void perf_simple_stat()
 {
+	struct perf_event event = PERF_EVENT(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_CLOCK, "cpu-clock");
 	int fd;
 	uint64_t count;
 
-	fd = perf_event_open(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_CLOCK, -1);
+	fd = perf_event_open(&event, -1);
 	if (fd < 0) {
 		printf("ERROR: Event not supported.");
 		exit(-1);
@@ -77,149 +324,696 @@ void perf_simple_stat()
 	perf_event_close(fd);
 }
 
-int __read_event_file(const char* path, char* buf, int buf_size)
+// Resolve sysfs events, cheap after the first time, see perf_pmu.c.
+void perf_stat_init_events(struct perf_event *events, int event_num)
 {
-	FILE *file;
-	int n_bytes;
+	for (int i = 0; i < event_num; i++) {
+		if (!events[i].event_path)
+			continue;
+		if (!events[i].event_name && strchr(events[i].event_path, '/'))
+			events[i].event_name = strchr(events[i].event_path, '/') + 1;
+		if (perf_pmu_resolve(events[i].event_path, &events[i]))
+			printf("WARNING: Can not open event: %s\n", events[i].event_path);
+	}
+}
+
+static void perf_stat_open_multiplex(struct perf_stat *stat)
+{
+	for (int i = 0; i < stat->event_num; i++)
+		stat->event_fds[i] = perf_event_open_scaled(&stat->events[i], stat->pid, stat->cpu);
+}
+
+static void perf_stat_open_group(struct perf_stat *stat)
+{
+	int fd;
+
+	stat->group_fd = -1;
 
-	file = fopen(path, "r");
-	if (file == NULL)
+	// The first event opened successfully becomes the group leader.
+	for (int i = 0; i < stat->event_num; i++) {
+		fd = perf_event_open_group(&stat->events[i], stat->pid, stat->cpu, stat->group_fd);
+		if (fd >= 0 && stat->group_fd < 0)
+			stat->group_fd = fd;
+		stat->event_fds[i] = fd;
+		// Counters of another task can not be read from here.
+		stat->event_pages[i] = fd >= 0 && !stat->pid ? perf_event_map_user(fd) : NULL;
+	}
+}
+
+static int __perf_stat_init(struct perf_stat *stat, const char* name, struct perf_event *events, int event_num, int cpu, int multiplex)
+{
+	if (!stat || !name || !events)
 		return ERROR;
 
-	n_bytes = fread(buf, 1, buf_size - 1, file);
+	if (event_num > MAX_STAT_EVENTS)
+		return ERROR;
 
-	fclose(file);
-	return n_bytes;
+	perf_stat_init_events(events, event_num);
+
+	memset(stat, 0, sizeof(struct perf_stat));
+	stat->events = events;
+	stat->event_num = event_num;
+	stat->cpu = cpu;
+	stat->multiplex = multiplex || event_num > MAX_GROUP_EVENTS;
+	stat->sample_fd = -1;
+	stat->thread_num = 1;
+	strncpy(stat->name, name, sizeof(stat->name) - 1);
+
+	// Events stay open and disabled between measurements, see perf_stat_destroy().
+	if (stat->multiplex)
+		perf_stat_open_multiplex(stat);
+	else
+		perf_stat_open_group(stat);
+
+	return SUCCESS;
 }
 
-int perf_stat_init_raw_event(struct perf_event *event)
+// Open the events as one group, see perf_sched_pack() for groups that fit the PMU.
+int perf_stat_init(struct perf_stat *stat, const char* name, struct perf_event *events, int event_num, int cpu)
 {
-	char *device_name, *file_name;
-	char file_buf[16];
-	static char file_path[128];
-	static char event_path[128];
-	int n_bytes, offset, end;
+	return __perf_stat_init(stat, name, events, event_num, cpu, 0);
+}
 
-	memset(event_path, 0, sizeof(event_path));
-	strncpy(event_path, event->event_path, sizeof(event_path) - 1);
+// Open every event on its own and let the kernel rotate them on the counters.
+int perf_stat_init_multiplex(struct perf_stat *stat, const char* name, struct perf_event *events, int event_num, int cpu)
+{
+	return __perf_stat_init(stat, name, events, event_num, cpu, 1);
+}
 
-	device_name = strtok(event_path, "/");
-	if (!device_name)
-		return ERROR;
+static void perf_stat_close_events(struct perf_stat *stat)
+{
+	for (int i = 0; i < stat->event_num; i++) {
+		if (stat->event_pages[i])
+			perf_event_unmap_user(stat->event_pages[i]);
+		stat->event_pages[i] = NULL;
+		if (stat->event_fds[i] >= 0)
+			perf_event_close(stat->event_fds[i]);
+		stat->event_fds[i] = -1;
+	}
 
-	file_name = strtok(NULL, "/");
-	if (!file_name)
-		return ERROR;
+	stat->group_fd = -1;
+}
 
-	if (!event->event_name)
-		event->event_name = event->event_path + (file_name - event_path);
+/*
+ * Core events count the thread that opened them, move them to task pid,
+ * or to the calling thread if pid is 0. Fails when no event could be
+ * opened on the task, e.g. without the permission to trace it.
+ */
+int perf_stat_attach(struct perf_stat *stat, pid_t pid)
+{
+	int opened = 0;
 
-	// Get type
-	sprintf(file_path, "/sys/bus/event_source/devices/%s/type", device_name);
+	perf_stat_close_events(stat);
 
-	n_bytes = __read_event_file(file_path, file_buf, sizeof(file_buf));
-	if (n_bytes <= 0)
-		return ERROR;
+	stat->pid = pid;
+	if (stat->multiplex)
+		perf_stat_open_multiplex(stat);
+	else
+		perf_stat_open_group(stat);
 
-	file_buf[n_bytes] = '\0';
-	event->type = atoi(file_buf);
+	for (int i = 0; i < stat->event_num; i++)
+		opened |= stat->event_fds[i] >= 0;
 
-	// Get format
-	sprintf(file_path, "/sys/bus/event_source/devices/%s/format/event", device_name);
+	return opened || !stat->event_num ? SUCCESS : ERROR;
+}
 
-	n_bytes = __read_event_file(file_path, file_buf, sizeof(file_buf));
-	if (n_bytes <= 0)
-		return ERROR;
+static void perf_series_free(struct perf_series *series)
+{
+	pthread_mutex_destroy(&series->lock);
+	pthread_cond_destroy(&series->cond);
+	free(series->times);
+	free(series->counts);
+	free(series);
+}
 
-	file_buf[n_bytes] = '\0';
-	sscanf(file_buf, "config:%d-%d", &offset, &end);
+// Stop the interval thread of perf_stat_set_interval().
+static void perf_series_exit(struct perf_stat *stat)
+{
+	struct perf_series *series = stat->series;
+
+	pthread_mutex_lock(&series->lock);
+	series->stop = 1;
+	pthread_cond_signal(&series->cond);
+	pthread_mutex_unlock(&series->lock);
+	pthread_join(series->thread, NULL);
+
+	perf_series_free(series);
+	stat->series = NULL;
+}
+
+void perf_stat_destroy(struct perf_stat *stat)
+{
+	if (stat->series)
+		perf_series_exit(stat);
+
+	perf_stat_close_events(stat);
+
+	if (stat->sample_page)
+		munmap(stat->sample_page, (1 + SAMPLE_PAGES) * sysconf(_SC_PAGESIZE));
+	stat->sample_page = NULL;
+	if (stat->sample_fd >= 0)
+		perf_event_close(stat->sample_fd);
+	stat->sample_fd = -1;
+	free(stat->samples);
+	stat->samples = NULL;
+	stat->sample_num = stat->sample_cap = 0;
+}
+
+static void perf_stat_begin_multiplex(struct perf_stat *stat)
+{
+	// Counts and times keep running totals across enables, remember where we start.
+	for (int i = 0; i < stat->event_num; i++)
+		if (stat->event_fds[i] >= 0)
+			stat->base_counts[i] = perf_event_read_scaled(stat->event_fds[i], &stat->base_enabled[i], &stat->base_running[i]);
 
-	// Get event
-	sprintf(file_path, "/sys/bus/event_source/devices/%s/events/%s", device_name, file_name);
+	clock_gettime(CLOCK_MONOTONIC, &stat->start);
 
-	n_bytes = __read_event_file(file_path, file_buf, sizeof(file_buf));
-	if (n_bytes <=0 )
+	for (int i = 0; i < stat->event_num; i++)
+		if (stat->event_fds[i] >= 0)
+			perf_event_start(stat->event_fds[i]);
+}
+
+static void perf_stat_end_multiplex(struct perf_stat *stat)
+{
+	uint64_t count, enabled, running;
+
+	for (int i = 0; i < stat->event_num; i++)
+		if (stat->event_fds[i] >= 0)
+			perf_event_stop(stat->event_fds[i]);
+
+	clock_gettime(CLOCK_MONOTONIC, &stat->end);
+
+	// Scale each count by the share of time it was actually on a counter.
+	for (int i = 0; i < stat->event_num; i++) {
+		stat->event_counts[i] = 0;
+		stat->time_enabled[i] = 0;
+		stat->time_running[i] = 0;
+		if (stat->event_fds[i] < 0)
+			continue;
+		count = perf_event_read_scaled(stat->event_fds[i], &enabled, &running);
+		stat->time_enabled[i] = enabled - stat->base_enabled[i];
+		stat->time_running[i] = running - stat->base_running[i];
+		if (stat->time_running[i])
+			stat->event_counts[i] = (uint64_t)((double)(count - stat->base_counts[i]) *	\
+				stat->time_enabled[i] / stat->time_running[i]);
+	}
+}
+
+static void perf_stat_begin_group(struct perf_stat *stat)
+{
+	if (stat->group_fd >= 0) {
+		perf_event_reset_group(stat->group_fd);
+		perf_event_start_group(stat->group_fd);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &stat->start);
+
+	// Take user space snapshots last, so they sit right next to the workload.
+	for (int i = 0; i < stat->event_num; i++) {
+		stat->user_read[i] = 0;
+		if (stat->event_pages[i] && !perf_event_read_user(stat->event_pages[i], &stat->user_counts[i]))
+			stat->user_read[i] = 1;
+	}
+}
+
+static void perf_stat_end_group(struct perf_stat *stat)
+{
+	uint64_t counts[MAX_GROUP_EVENTS];
+	uint64_t user_counts[MAX_STAT_EVENTS];
+	int nr = 0;
+
+	for (int i = 0; i < stat->event_num; i++)
+		if (stat->user_read[i] && perf_event_read_user(stat->event_pages[i], &user_counts[i]))
+			stat->user_read[i] = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &stat->end);
+
+	if (stat->group_fd >= 0) {
+		perf_event_stop_group(stat->group_fd);
+		nr = perf_event_read_group(stat->group_fd, counts, MAX_GROUP_EVENTS);
+	}
+
+	/*
+	 * Group counts come back in open order, skipping events that failed to
+	 * open. Events read from user space use their snapshot delta instead,
+	 * the rest (e.g. software events) fall back to the group read.
+	 */
+	for (int i = 0, j = 0; i < stat->event_num; i++) {
+		stat->event_counts[i] = 0;
+		if (stat->event_fds[i] < 0)
+			continue;
+		if (stat->user_read[i])
+			stat->event_counts[i] = user_counts[i] - stat->user_counts[i];
+		else if (j < nr)
+			stat->event_counts[i] = counts[j];
+		j++;
+	}
+}
+
+/*
+ * Sampling
+ *
+ * A sampling event runs as its own group leader next to the counting
+ * events, enabled and disabled with them. Samples are written by the
+ * kernel to a ring buffer and collected in perf_stat_end(), so the buffer
+ * must hold the samples of one measurement, the rest is counted as lost.
+ */
+
+int perf_stat_sample(struct perf_stat *stat, struct perf_event *event, uint64_t period)
+{
+	void *page;
+
+	perf_stat_init_events(event, 1);
+
+	stat->sample_fd = perf_event_open_sampling(event, stat->cpu, period);
+	if (stat->sample_fd < 0)
 		return ERROR;
 
-	file_buf[n_bytes] = '\0';
-	sscanf(file_buf, "event=%lX", &event->event_id);
-	event->event_id = event->event_id << offset;
+	page = mmap(NULL, (1 + SAMPLE_PAGES) * sysconf(_SC_PAGESIZE), PROT_READ | PROT_WRITE, MAP_SHARED, stat->sample_fd, 0);
+	if (page == MAP_FAILED) {
+		perf_event_close(stat->sample_fd);
+		stat->sample_fd = -1;
+		return ERROR;
+	}
+
+	stat->sample_page = (struct perf_event_mmap_page*)page;
+	stat->sample_event = event;
+	stat->sample_period = period;
 
 	return SUCCESS;
 }
 
-void perf_stat_init_events(struct perf_event *events, int event_num)
+void perf_stat_reset_samples(struct perf_stat *stat)
 {
-	int err;
-	for (int i = 0; i < event_num; i++) {
-		if (events[i].event_path && !events[i].event_id) {
-			err = perf_stat_init_raw_event(&events[i]);
-			if (err) {
-				printf("WARNING: Can not open event: %s\n", events[i].event_path);
-				continue;
+	stat->sample_num = 0;
+	stat->sample_lost = 0;
+}
+
+// Copy len bytes at offset of the ring buffer, records may wrap around its end.
+static void __ring_copy(const char *data, uint64_t size, uint64_t offset, void *dst, size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+		((char*)dst)[i] = data[(offset + i) % size];
+}
+
+static void perf_stat_read_samples(struct perf_stat *stat)
+{
+	struct perf_event_mmap_page *page = stat->sample_page;
+	struct perf_event_header header;
+	struct perf_sample sample;
+	uint64_t head, tail, size, lost[2];
+	char *data;
+
+	size = page->data_size ? page->data_size : SAMPLE_PAGES * sysconf(_SC_PAGESIZE);
+	data = (char*)page + (page->data_offset ? page->data_offset : sysconf(_SC_PAGESIZE));
+
+	head = page->data_head;
+	__sync_synchronize();
+	tail = page->data_tail;
+
+	while (tail < head) {
+		__ring_copy(data, size, tail, &header, sizeof(header));
+		if (header.size < sizeof(header))
+			break;
+
+		if (header.type == PERF_RECORD_SAMPLE) {
+			__ring_copy(data, size, tail + sizeof(header), &sample, sizeof(sample));
+			if (stat->sample_num == stat->sample_cap) {
+				stat->sample_cap = stat->sample_cap ? stat->sample_cap * 2 : 1024;
+				stat->samples = realloc(stat->samples, sizeof(struct perf_sample) * stat->sample_cap);
 			}
+			stat->samples[stat->sample_num++] = sample;
+		} else if (header.type == PERF_RECORD_LOST) {
+			// struct { u64 id; u64 lost; }
+			__ring_copy(data, size, tail + sizeof(header), lost, sizeof(lost));
+			stat->sample_lost += lost[1];
 		}
+
+		tail += header.size;
 	}
+
+	__sync_synchronize();
+	page->data_tail = tail;
 }
 
-int perf_stat_init(struct perf_stat *stat, const char* name, struct perf_event *events, int event_num, int cpu)
+/*
+ * Interval series
+ *
+ * A helper thread reads the counters every interval while a measurement
+ * runs. It moves off the measured CPU when it can, so it does not preempt
+ * the workload. The thread lives as long as the stat, perf_stat_begin()
+ * arms it once the counters run and perf_stat_end() disarms it at once.
+ */
+
+static long __timespec_ns(struct timespec *ts)
 {
-	if (!stat || !name || !events)
+	return ts->tv_sec * 1000000000L + ts->tv_nsec;
+}
+
+static void perf_series_read(struct perf_stat *stat)
+{
+	struct perf_series *series = stat->series;
+	uint64_t counts[MAX_GROUP_EVENTS], *point;
+	uint64_t count, enabled, running;
+	struct timespec now;
+	int nr = 0;
+
+	if (series->num == series->cap) {
+		series->cap = series->cap ? series->cap * 2 : 256;
+		series->times = realloc(series->times, sizeof(long) * series->cap);
+		series->counts = realloc(series->counts, sizeof(uint64_t) * series->cap * stat->event_num);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	series->times[series->num] = __timespec_ns(&now);
+	point = &series->counts[series->num * stat->event_num];
+	series->num++;
+
+	if (!stat->multiplex && stat->group_fd >= 0)
+		nr = perf_event_read_group(stat->group_fd, counts, MAX_GROUP_EVENTS);
+
+	// Same mapping as perf_stat_end_group() and perf_stat_end_multiplex().
+	for (int i = 0, j = 0; i < stat->event_num; i++) {
+		point[i] = 0;
+		if (stat->event_fds[i] < 0)
+			continue;
+		if (stat->multiplex) {
+			count = perf_event_read_scaled(stat->event_fds[i], &enabled, &running);
+			if (running > stat->base_running[i])
+				point[i] = (uint64_t)((double)(count - stat->base_counts[i]) *	\
+					(enabled - stat->base_enabled[i]) / (running - stat->base_running[i]));
+		} else if (j < nr) {
+			point[i] = counts[j];
+		}
+		j++;
+	}
+}
+
+static void* perf_series_thread(void *arg)
+{
+	struct perf_stat *stat = arg;
+	struct perf_series *series = stat->series;
+	struct timespec deadline;
+	cpu_set_t mask;
+	long ns;
+
+	// Inherited affinity is the measured CPU only, run anywhere else.
+	if (stat->cpu >= 0) {
+		CPU_ZERO(&mask);
+		for (int i = 0; i < sysconf(_SC_NPROCESSORS_ONLN) && i < CPU_SETSIZE; i++)
+			if (i != stat->cpu)
+				CPU_SET(i, &mask);
+		if (CPU_COUNT(&mask))
+			pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask);
+	}
+
+	pthread_mutex_lock(&series->lock);
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	while (!series->stop) {
+		// Idle between measurements, the intervals count from the arming.
+		if (!series->armed) {
+			pthread_cond_wait(&series->cond, &series->lock);
+			clock_gettime(CLOCK_MONOTONIC, &deadline);
+			continue;
+		}
+		ns = deadline.tv_nsec + series->interval;
+		deadline.tv_sec += ns / 1000000000L;
+		deadline.tv_nsec = ns % 1000000000L;
+		if (pthread_cond_timedwait(&series->cond, &series->lock, &deadline) == ETIMEDOUT && series->armed)
+			perf_series_read(stat);
+	}
+	pthread_mutex_unlock(&series->lock);
+
+	return NULL;
+}
+
+int perf_stat_set_interval(struct perf_stat *stat, long interval_us)
+{
+	struct perf_series *series;
+	pthread_condattr_t attr;
+
+	if (interval_us <= 0)
 		return ERROR;
 
-	if (event_num > MAX_PERF_EVENTS)
+	series = malloc(sizeof(struct perf_series));
+	if (!series)
 		return ERROR;
 
-	perf_stat_init_events(events, event_num);
+	memset(series, 0, sizeof(struct perf_series));
+	series->interval = interval_us * 1000;
+	pthread_mutex_init(&series->lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&series->cond, &attr);
+	pthread_condattr_destroy(&attr);
 
-	memset(stat, 0, sizeof(struct perf_stat));
-	stat->events = events;
-	stat->event_num = event_num;
-	stat->cpu = cpu;
-	strncpy(stat->name, name, sizeof(stat->name) - 1);
+	stat->series = series;
+
+	if (pthread_create(&series->thread, NULL, perf_series_thread, stat)) {
+		stat->series = NULL;
+		perf_series_free(series);
+		return ERROR;
+	}
 
 	return SUCCESS;
 }
 
-void perf_stat_begin(struct perf_stat *stat)
+// Called once the counters run, so a multiplexed read finds its base counts.
+static void perf_series_start(struct perf_stat *stat)
 {
-	for (int i = 0; i < stat->event_num; i++)
-		stat->event_fds[i] = perf_event_open(stat->events[i].type, stat->events[i].event_id, stat->cpu);
+	struct perf_series *series = stat->series;
 
-	clock_gettime(CLOCK_MONOTONIC, &stat->start);
+	pthread_mutex_lock(&series->lock);
+	series->num = 0;
+	series->armed = 1;
+	pthread_cond_signal(&series->cond);
+	pthread_mutex_unlock(&series->lock);
+}
 
-	for (int i = 0; i < stat->event_num; i++)
-		if (stat->event_fds[i] > 0)
-			perf_event_start(stat->event_fds[i]);
+static void perf_series_stop(struct perf_stat *stat)
+{
+	struct perf_series *series = stat->series;
+	long start = __timespec_ns(&stat->start);
+
+	pthread_mutex_lock(&series->lock);
+	series->armed = 0;
+	pthread_cond_signal(&series->cond);
+	pthread_mutex_unlock(&series->lock);
+
+	// Reads between the end and the disarming saw the stopped counters.
+	while (series->num && series->times[series->num - 1] >= __timespec_ns(&stat->end))
+		series->num--;
+
+	// Close the series with the final counts at the end of the measurement.
+	perf_series_read(stat);
+	series->times[series->num - 1] = __timespec_ns(&stat->end);
+	memcpy(&series->counts[(series->num - 1) * stat->event_num], stat->event_counts,	\
+		sizeof(uint64_t) * stat->event_num);
+
+	for (int i = 0; i < series->num; i++)
+		series->times[i] -= start;
 }
 
-void perf_stat_end(struct perf_stat *stat)
+static void __perf_stat_begin(struct perf_stat *stat)
+{
+	stat->metric_num = 0;
+
+	if (stat->sample_fd >= 0)
+		perf_event_start(stat->sample_fd);
+
+	if (stat->multiplex)
+		perf_stat_begin_multiplex(stat);
+	else
+		perf_stat_begin_group(stat);
+}
+
+static void __perf_stat_end(struct perf_stat *stat)
 {
 	long secs, nano;
 
-	for (int i = 0; i < stat->event_num; i++)
-		if (stat->event_fds[i] > 0)
-			perf_event_stop(stat->event_fds[i]);
+	if (stat->multiplex)
+		perf_stat_end_multiplex(stat);
+	else
+		perf_stat_end_group(stat);
 
-	clock_gettime(CLOCK_MONOTONIC, &stat->end);
 	secs = stat->end.tv_sec - stat->start.tv_sec;
 	nano = stat->end.tv_nsec - stat->start.tv_nsec;
 	stat->duration = secs * 1000000000L + nano;
 
+	if (stat->sample_fd >= 0) {
+		perf_event_stop(stat->sample_fd);
+		perf_stat_read_samples(stat);
+	}
+}
+
+void perf_stat_begin(struct perf_stat *stat)
+{
+	__perf_stat_begin(stat);
+
+	if (stat->series)
+		perf_series_start(stat);
+}
+
+void perf_stat_end(struct perf_stat *stat)
+{
+	__perf_stat_end(stat);
+
+	if (stat->series)
+		perf_series_stop(stat);
+}
+
+/*
+ * Measurement overhead calibration
+ *
+ * An empty begin/end pair is measured many times and the medians are kept
+ * as the cost of measuring itself. Results are cached per CPU, task and
+ * event list, configs and privilege levels included, so the same group is
+ * only calibrated once per process. Workers of a threaded case calibrate
+ * at the same time, the cache is locked.
+ */
+
+struct perf_overhead {
+	int cpu;
+	pid_t pid;
+	int event_num;
+	uint32_t types[MAX_STAT_EVENTS];
+	uint64_t event_ids[MAX_STAT_EVENTS];
+	uint64_t config1[MAX_STAT_EVENTS];
+	uint64_t config2[MAX_STAT_EVENTS];
+	int privs[MAX_STAT_EVENTS];
+	uint64_t counts[MAX_STAT_EVENTS];
+	long duration;
+};
+
+static struct perf_overhead overhead_cache[MAX_OVERHEAD_CACHE];
+static int overhead_cache_num = 0;
+static pthread_mutex_t overhead_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct perf_overhead* perf_overhead_find(struct perf_stat *stat)
+{
+	struct perf_overhead *p_oh;
+	int i, j;
+
+	for (i = 0; i < overhead_cache_num; i++) {
+		p_oh = &overhead_cache[i];
+		if (p_oh->cpu != stat->cpu || p_oh->pid != stat->pid || p_oh->event_num != stat->event_num)
+			continue;
+		for (j = 0; j < stat->event_num; j++)
+			if (p_oh->types[j] != stat->events[j].type || p_oh->event_ids[j] != stat->events[j].event_id ||	\
+			    p_oh->config1[j] != stat->events[j].config1 || p_oh->config2[j] != stat->events[j].config2 ||	\
+			    p_oh->privs[j] != stat->events[j].priv)
+				break;
+		if (j == stat->event_num)
+			return p_oh;
+	}
+
+	return NULL;
+}
+
+static void perf_overhead_save(struct perf_stat *stat)
+{
+	struct perf_overhead *p_oh;
+
+	if (overhead_cache_num >= MAX_OVERHEAD_CACHE)
+		return;
+
+	p_oh = &overhead_cache[overhead_cache_num++];
+	p_oh->cpu = stat->cpu;
+	p_oh->pid = stat->pid;
+	p_oh->event_num = stat->event_num;
 	for (int i = 0; i < stat->event_num; i++) {
-		if (stat->event_fds[i] > 0) {
-			stat->event_counts[i] = perf_event_read(stat->event_fds[i]);
-			perf_event_close(stat->event_fds[i]);
-		}
+		p_oh->types[i] = stat->events[i].type;
+		p_oh->event_ids[i] = stat->events[i].event_id;
+		p_oh->config1[i] = stat->events[i].config1;
+		p_oh->config2[i] = stat->events[i].config2;
+		p_oh->privs[i] = stat->events[i].priv;
+		p_oh->counts[i] = stat->overhead_counts[i];
+	}
+	p_oh->duration = stat->overhead_duration;
+}
+
+int perf_stat_calibrate(struct perf_stat *stat, int loops)
+{
+	struct perf_overhead *p_oh;
+	double *samples;
+
+	if (loops <= 0)
+		return ERROR;
+
+	pthread_mutex_lock(&overhead_lock);
+	p_oh = perf_overhead_find(stat);
+	if (p_oh) {
+		memcpy(stat->overhead_counts, p_oh->counts, sizeof(uint64_t) * stat->event_num);
+		stat->overhead_duration = p_oh->duration;
+		stat->calibrated = 1;
 	}
+	pthread_mutex_unlock(&overhead_lock);
+	if (p_oh)
+		return SUCCESS;
+
+	samples = malloc(sizeof(double) * loops * (stat->event_num + 1));
+	if (!samples)
+		return ERROR;
+
+	// Empty measurements have no series to record.
+	for (int i = 0; i < loops; i++) {
+		__perf_stat_begin(stat);
+		__perf_stat_end(stat);
+		samples[i] = stat->duration;
+		for (int j = 0; j < stat->event_num; j++)
+			samples[(j + 1) * loops + i] = stat->event_counts[j];
+	}
+
+	stat->overhead_duration = perf_summary_median(samples, loops);
+	for (int j = 0; j < stat->event_num; j++)
+		stat->overhead_counts[j] = perf_summary_median(&samples[(j + 1) * loops], loops);
+	stat->calibrated = 1;
+
+	pthread_mutex_lock(&overhead_lock);
+	perf_overhead_save(stat);
+	pthread_mutex_unlock(&overhead_lock);
+
+	free(samples);
+	return SUCCESS;
+}
+
+// Percentage of the enabled time an event was counting, 100 when not multiplexed.
+double perf_stat_running(struct perf_stat *stat, int idx)
+{
+	if (!stat->multiplex || !stat->time_enabled[idx])
+		return 100.0;
+
+	return 100.0 * stat->time_running[idx] / stat->time_enabled[idx];
+}
+
+// Record a case metric for the current measurement, cleared by the next begin.
+int perf_stat_add_metric(struct perf_stat *stat, const char *name, const char *unit, double value)
+{
+	struct perf_metric *metric;
+
+	if (stat->metric_num >= MAX_STAT_METRICS)
+		return ERROR;
+
+	metric = &stat->metrics[stat->metric_num++];
+	snprintf(metric->name, METRIC_NAME_LEN, "%s", name);
+	snprintf(metric->unit, METRIC_UNIT_LEN, "%s", unit);
+	metric->value = value;
+
+	return SUCCESS;
 }
 
 void perf_stat_report(struct perf_stat *stat)
 {
 	printf("TEST: %s\n", stat->name);
 	printf("-----------------------\n");
-	for (int i = 0; i < stat->event_num; i++)
-		printf("%*s: %*ld\n", 16, stat->events[i].event_name, 16, stat->event_counts[i]);
+	for (int i = 0; i < stat->event_num; i++) {
+		printf("%*s: %*ld", 16, stat->events[i].event_name, 16, stat->event_counts[i]);
+		if (stat->multiplex)
+			printf("  (%.2f%%)", perf_stat_running(stat, i));
+		printf("\n");
+	}
+	for (int i = 0; i < stat->metric_num; i++)
+		printf("%*s: %*.3f %s\n", 16, stat->metrics[i].name, 16, stat->metrics[i].value, stat->metrics[i].unit);
 	printf("-----------------------\n");
 	printf("Time spent: %f ms\n\n", (double)stat->duration / 1000000);
 }
@@ -4,14 +4,29 @@
 #include <stdint.h>
 #include <stdint.h>
 #include <time.h>
+#include <pthread.h>
 #include <linux/perf_event.h>
 
 #define EVENT_NAME_LEN		32
 #define STAT_NAME_LEN		32
-#define MAX_PERF_EVENTS		6
+#define MAX_PERF_EVENTS		6	/* group size when the PMU can not be probed */
+#define MAX_GROUP_EVENTS	32
+#define MAX_STAT_EVENTS		128
+#define MAX_OVERHEAD_CACHE	64
+#define MAX_STAT_METRICS	8
+#define METRIC_NAME_LEN		32
+#define METRIC_UNIT_LEN		16
+#define SAMPLE_PAGES		256
 #define SUCCESS			0
 #define ERROR			-1
 
+// Where an event counts, set with the ":u" and ":k" modifiers.
+enum {
+	PERF_PRIV_ALL,
+	PERF_PRIV_USER,
+	PERF_PRIV_KERNEL,
+};
+
 #define PERF_EVENT(_type, _id, _name) \
 	{.event_name = _name, .type = _type, .event_id = _id, .event_path = NULL}
 
@@ -22,28 +37,87 @@ struct perf_event {
 	char *event_name;
 	char *event_path;
 	uint32_t type;
-	uint64_t event_id;
+	uint64_t event_id;	/* attr config */
+	uint64_t config1;
+	uint64_t config2;
+	int system_wide;	/* uncore, counts every task, opened on sys_cpu */
+	int sys_cpu;
+	int priv;		/* PERF_PRIV_* */
+};
+
+// A value computed by the case itself, e.g. bandwidth or latency.
+struct perf_metric {
+	char name[METRIC_NAME_LEN];
+	char unit[METRIC_UNIT_LEN];
+	double value;
+};
+
+struct perf_sample {
+	uint64_t ip;
+	uint32_t pid;
+	uint32_t tid;
+	uint64_t time;
+};
+
+// Counts read by a helper thread every interval while a measurement runs.
+struct perf_series {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int armed;			/* a measurement runs, read every interval */
+	int stop;			/* the thread exits */
+	long interval;			/* ns */
+	long *times;			/* [num], ns since start */
+	uint64_t *counts;		/* [num][event_num], totals since start */
+	int num;
+	int cap;
 };
 
 struct perf_stat {
 	char name[STAT_NAME_LEN];
 	struct perf_event *events;
-	uint64_t event_counts[MAX_PERF_EVENTS];
-	int event_fds[MAX_PERF_EVENTS];
+	uint64_t event_counts[MAX_STAT_EVENTS];
+	uint64_t time_enabled[MAX_STAT_EVENTS];
+	uint64_t time_running[MAX_STAT_EVENTS];
+	uint64_t base_counts[MAX_STAT_EVENTS];
+	uint64_t base_enabled[MAX_STAT_EVENTS];
+	uint64_t base_running[MAX_STAT_EVENTS];
+	int event_fds[MAX_STAT_EVENTS];
+	struct perf_event_mmap_page *event_pages[MAX_STAT_EVENTS];
+	uint64_t user_counts[MAX_STAT_EVENTS];
+	int user_read[MAX_STAT_EVENTS];
 	int event_num;
+	int group_fd;
+	int multiplex;
+	int calibrated;
+	uint64_t overhead_counts[MAX_STAT_EVENTS];
+	long overhead_duration;
+	struct perf_metric metrics[MAX_STAT_METRICS];
+	int metric_num;
+	struct perf_event *sample_event;
+	uint64_t sample_period;
+	int sample_fd;
+	struct perf_event_mmap_page *sample_page;
+	struct perf_sample *samples;
+	int sample_num;
+	int sample_cap;
+	uint64_t sample_lost;
+	struct perf_series *series;
+	int thread_id;			/* this thread and the number of threads */
+	int thread_num;			/* running the case, see "-t" */
 	int cpu;
+	pid_t pid;			/* task counted by core events, 0 for the caller */
 	struct timespec start;
 	struct timespec end;
 	long duration;
 };
 
-/* easy to use macros */
+/* easy to use macros, see perf_region.h to count a region many times */
 #define PERF_STAT_BEGIN(name, events, event_num) 				\
 	do {									\
-		int cpu, err;							\
+		int err;							\
 		struct perf_stat *__stat = malloc(sizeof(struct perf_stat));	\
-		cpu = sched_getcpu()						\
-		err = perf_stat_init(__stat, name, events, event_num, cpu);	\
+		err = perf_stat_init(__stat, name, events, event_num, -1);	\
 		if (err) {							\
 			free(__stat);						\
 			break;							\
@@ -53,20 +127,42 @@ struct perf_stat {
 #define PERF_STAT_END()								\
 		perf_stat_end(__stat);						\
 		perf_stat_report(__stat);					\
+		perf_stat_destroy(__stat);					\
 		free(__stat);							\
 	} while (0)
 
 /* perf event interfaces */
-int perf_event_open(uint32_t type, uint64_t event_id, int cpu);
+int perf_event_open(struct perf_event *event, int cpu);
+int perf_event_open_group(struct perf_event *event, pid_t pid, int cpu, int group_fd);
+int perf_event_open_scaled(struct perf_event *event, pid_t pid, int cpu);
 int perf_event_start(int fd);
 int perf_event_stop(int fd);
+int perf_event_reset_group(int group_fd);
+int perf_event_start_group(int group_fd);
+int perf_event_stop_group(int group_fd);
 uint64_t perf_event_read(int fd);
+uint64_t perf_event_read_scaled(int fd, uint64_t *enabled, uint64_t *running);
+int perf_event_read_group(int group_fd, uint64_t *counts, int count_num);
 int perf_event_close(int fd);
+struct perf_event_mmap_page* perf_event_map_user(int fd);
+void perf_event_unmap_user(struct perf_event_mmap_page *page);
+int perf_event_read_user(struct perf_event_mmap_page *page, uint64_t *count);
+int perf_event_open_sampling(struct perf_event *event, int cpu, uint64_t period);
 
 /* perf stat interfaces */
+void perf_stat_init_events(struct perf_event *events, int event_num);
 int perf_stat_init(struct perf_stat *stat, const char* name, struct perf_event *events, int event_num, int cpu);
+int perf_stat_init_multiplex(struct perf_stat *stat, const char* name, struct perf_event *events, int event_num, int cpu);
+int perf_stat_attach(struct perf_stat *stat, pid_t pid);
+void perf_stat_destroy(struct perf_stat *stat);
 void perf_stat_begin(struct perf_stat *stat);
 void perf_stat_end(struct perf_stat *stat);
 void perf_stat_report(struct perf_stat *stat);
+double perf_stat_running(struct perf_stat *stat, int idx);
+int perf_stat_calibrate(struct perf_stat *stat, int loops);
+int perf_stat_add_metric(struct perf_stat *stat, const char *name, const char *unit, double value);
+int perf_stat_sample(struct perf_stat *stat, struct perf_event *event, uint64_t period);
+void perf_stat_reset_samples(struct perf_stat *stat);
+int perf_stat_set_interval(struct perf_stat *stat, long interval_us);
 
 #endif
@@ -0,0 +1,155 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "perf_stat.h"
+#include "perf_summary.h"
+
+// Samples further than this many MAD based z-scores from the median are outliers.
+#define OUTLIER_ZSCORE		3.5
+
+static int __compare_double(const void *a, const void *b)
+{
+	double x = *(const double*)a, y = *(const double*)b;
+	return x < y ? -1 : x > y;
+}
+
+// Percentile of sorted samples, linearly interpolated between ranks.
+static double __percentile(const double *sorted, int num, double pct)
+{
+	double rank = pct / 100 * (num - 1);
+	int low = (int)rank;
+
+	if (low >= num - 1)
+		return sorted[num - 1];
+
+	return sorted[low] + (sorted[low + 1] - sorted[low]) * (rank - low);
+}
+
+// Median of samples, the samples are sorted in place.
+double perf_summary_median(double *samples, int num)
+{
+	if (num <= 0)
+		return 0;
+
+	qsort(samples, num, sizeof(double), __compare_double);
+
+	return __percentile(samples, num, 50);
+}
+
+int perf_summary_calc(struct perf_summary *sum, const double *samples, int num)
+{
+	double *sorted, *devs;
+	double median, mad, total = 0, var = 0;
+	int kept = 0;
+
+	memset(sum, 0, sizeof(struct perf_summary));
+
+	if (num <= 0)
+		return ERROR;
+
+	sorted = malloc(sizeof(double) * num);
+	devs = malloc(sizeof(double) * num);
+	if (!sorted || !devs) {
+		free(sorted);
+		free(devs);
+		return ERROR;
+	}
+
+	memcpy(sorted, samples, sizeof(double) * num);
+	median = perf_summary_median(sorted, num);
+
+	for (int i = 0; i < num; i++)
+		devs[i] = fabs(sorted[i] - median);
+	mad = perf_summary_median(devs, num);
+
+	/*
+	 * Reject outliers by the modified z-score (0.6745 * |x - median| / MAD),
+	 * nothing is rejected when more than half of the samples are equal.
+	 */
+	for (int i = 0; i < num; i++) {
+		if (mad > 0 && 0.6745 * fabs(sorted[i] - median) / mad > OUTLIER_ZSCORE)
+			continue;
+		sorted[kept++] = sorted[i];
+	}
+
+	for (int i = 0; i < kept; i++)
+		total += sorted[i];
+	sum->mean = total / kept;
+
+	for (int i = 0; i < kept; i++)
+		var += (sorted[i] - sum->mean) * (sorted[i] - sum->mean);
+	sum->stddev = kept > 1 ? sqrt(var / (kept - 1)) : 0;
+
+	sum->num = num;
+	sum->outliers = num - kept;
+	sum->median = __percentile(sorted, kept, 50);
+	sum->p5 = __percentile(sorted, kept, 5);
+	sum->p95 = __percentile(sorted, kept, 95);
+	sum->cv = sum->mean != 0 ? sum->stddev / sum->mean : 0;
+
+	free(sorted);
+	free(devs);
+
+	return SUCCESS;
+}
+
+struct __rank_sample {
+	double value;
+	int group;
+};
+
+static int __compare_rank(const void *a, const void *b)
+{
+	return __compare_double(&((const struct __rank_sample*)a)->value, &((const struct __rank_sample*)b)->value);
+}
+
+/*
+ * Two-sided p-value of the Mann-Whitney U test that two sample sets come
+ * from the same distribution. Uses the normal approximation with tie and
+ * continuity correction, good enough from about 5 samples per set.
+ */
+double perf_summary_mannwhitney(const double *a, int na, const double *b, int nb)
+{
+	struct __rank_sample *all;
+	double rank_a = 0, ties = 0, u, mu, sigma, z;
+	int n = na + nb, i, j;
+
+	if (na <= 0 || nb <= 0)
+		return 1.0;
+
+	all = malloc(sizeof(struct __rank_sample) * n);
+	if (!all)
+		return 1.0;
+
+	for (i = 0; i < na; i++)
+		all[i] = (struct __rank_sample){a[i], 0};
+	for (i = 0; i < nb; i++)
+		all[na + i] = (struct __rank_sample){b[i], 1};
+
+	qsort(all, n, sizeof(struct __rank_sample), __compare_rank);
+
+	// Equal values share the average of their ranks.
+	for (i = 0; i < n; i = j) {
+		for (j = i + 1; j < n && all[j].value == all[i].value; j++)
+			;
+		for (int k = i; k < j; k++)
+			if (!all[k].group)
+				rank_a += (i + j + 1) / 2.0;
+		ties += pow(j - i, 3) - (j - i);
+	}
+
+	free(all);
+
+	u = rank_a - (double)na * (na + 1) / 2;
+	mu = (double)na * nb / 2;
+	sigma = sqrt((double)na * nb / 12 * ((n + 1) - ties / ((double)n * (n - 1))));
+	if (sigma <= 0)
+		return 1.0;
+
+	z = (fabs(u - mu) - 0.5) / sigma;
+	if (z < 0)
+		z = 0;
+
+	return erfc(z / sqrt(2));
+}
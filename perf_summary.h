@@ -0,0 +1,20 @@
+#ifndef __PERF_SUMMARY_H
+#define __PERF_SUMMARY_H
+
+struct perf_summary {
+	int num;
+	int outliers;
+	double median;
+	double mean;
+	double stddev;
+	double cv;
+	double p5;
+	double p95;
+};
+
+/* statistics over repeated samples */
+double perf_summary_median(double *samples, int num);
+int perf_summary_calc(struct perf_summary *sum, const double *samples, int num);
+double perf_summary_mannwhitney(const double *a, int na, const double *b, int nb);
+
+#endif
@@ -0,0 +1,231 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <link.h>
+#include <elf.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "perf_stat.h"
+#include "perf_symbol.h"
+
+/*
+ * Symbols are read from the ELF files of the loaded objects: .symtab when
+ * the file is not stripped, .dynsym otherwise. Objects are listed with
+ * dl_iterate_phdr(), which also gives the load base for PIE and shared
+ * libraries, and their symbols are loaded on the first lookup.
+ */
+
+static int __compare_symbol(const void *a, const void *b)
+{
+	const struct perf_symbol *x = a, *y = b;
+	return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+static int __add_module(struct dl_phdr_info *info, size_t size, void *data)
+{
+	struct perf_symtab *symtab = data;
+	struct perf_module *module;
+	const ElfW(Phdr) *phdr;
+	uint64_t start = UINT64_MAX, end = 0;
+	char exe[PATH_MAX];
+	ssize_t len;
+
+	for (int i = 0; i < info->dlpi_phnum; i++) {
+		phdr = &info->dlpi_phdr[i];
+		if (phdr->p_type != PT_LOAD)
+			continue;
+		if (info->dlpi_addr + phdr->p_vaddr < start)
+			start = info->dlpi_addr + phdr->p_vaddr;
+		if (info->dlpi_addr + phdr->p_vaddr + phdr->p_memsz > end)
+			end = info->dlpi_addr + phdr->p_vaddr + phdr->p_memsz;
+	}
+	if (start >= end)
+		return 0;
+
+	symtab->modules = realloc(symtab->modules, sizeof(struct perf_module) * (symtab->module_num + 1));
+	module = &symtab->modules[symtab->module_num++];
+	memset(module, 0, sizeof(struct perf_module));
+
+	// The executable comes first with an empty name.
+	if (info->dlpi_name && info->dlpi_name[0])
+		module->path = strdup(info->dlpi_name);
+	else if ((len = readlink("/proc/self/exe", exe, sizeof(exe) - 1)) > 0)
+		module->path = strndup(exe, len);
+	else
+		module->path = strdup("/proc/self/exe");
+	module->base = info->dlpi_addr;
+	module->start = start;
+	module->end = end;
+
+	return 0;
+}
+
+static int __load_table(struct perf_module *module, const char *map, size_t map_size, const Elf64_Shdr *sym_sec, const Elf64_Shdr *str_sec)
+{
+	const Elf64_Sym *sym;
+	const char *strs;
+	int num, kept = 0;
+
+	if (sym_sec->sh_offset + sym_sec->sh_size > map_size || str_sec->sh_offset + str_sec->sh_size > map_size)
+		return ERROR;
+
+	sym = (const Elf64_Sym*)(map + sym_sec->sh_offset);
+	strs = map + str_sec->sh_offset;
+	num = sym_sec->sh_size / sizeof(Elf64_Sym);
+
+	module->symbols = malloc(sizeof(struct perf_symbol) * num);
+
+	for (int i = 0; i < num; i++) {
+		if (ELF64_ST_TYPE(sym[i].st_info) != STT_FUNC || !sym[i].st_value || sym[i].st_shndx == SHN_UNDEF)
+			continue;
+		if (sym[i].st_name >= str_sec->sh_size)
+			continue;
+		module->symbols[kept].addr = sym[i].st_value;
+		module->symbols[kept].size = sym[i].st_size;
+		module->symbols[kept].name = strdup(strs + sym[i].st_name);
+		kept++;
+	}
+
+	module->symbol_num = kept;
+	qsort(module->symbols, kept, sizeof(struct perf_symbol), __compare_symbol);
+
+	return SUCCESS;
+}
+
+static void __load_module(struct perf_module *module)
+{
+	const Elf64_Ehdr *ehdr;
+	const Elf64_Shdr *shdr, *symtab = NULL, *dynsym = NULL;
+	struct stat st;
+	char *map;
+	int fd;
+
+	module->loaded = 1;
+
+	fd = open(module->path, O_RDONLY);
+	if (fd < 0)
+		return;
+
+	if (fstat(fd, &st) || st.st_size < sizeof(Elf64_Ehdr)) {
+		close(fd);
+		return;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return;
+
+	ehdr = (const Elf64_Ehdr*)map;
+	if (memcmp(ehdr->e_ident, ELFMAG, SELFMAG) || ehdr->e_ident[EI_CLASS] != ELFCLASS64)
+		goto EXIT;
+	if (ehdr->e_shoff + ehdr->e_shnum * sizeof(Elf64_Shdr) > st.st_size)
+		goto EXIT;
+
+	shdr = (const Elf64_Shdr*)(map + ehdr->e_shoff);
+	for (int i = 0; i < ehdr->e_shnum; i++) {
+		if (shdr[i].sh_type == SHT_SYMTAB)
+			symtab = &shdr[i];
+		else if (shdr[i].sh_type == SHT_DYNSYM)
+			dynsym = &shdr[i];
+	}
+
+	if (!symtab)
+		symtab = dynsym;
+	if (symtab && symtab->sh_link < ehdr->e_shnum)
+		__load_table(module, map, st.st_size, symtab, &shdr[symtab->sh_link]);
+
+EXIT:
+	munmap(map, st.st_size);
+}
+
+struct perf_symtab* perf_symtab_create()
+{
+	struct perf_symtab *symtab;
+
+	symtab = malloc(sizeof(struct perf_symtab));
+	if (!symtab)
+		return NULL;
+
+	memset(symtab, 0, sizeof(struct perf_symtab));
+	dl_iterate_phdr(__add_module, symtab);
+
+	return symtab;
+}
+
+void perf_symtab_destroy(struct perf_symtab *symtab)
+{
+	struct perf_module *module;
+
+	if (!symtab)
+		return;
+
+	for (int i = 0; i < symtab->module_num; i++) {
+		module = &symtab->modules[i];
+		for (int j = 0; j < module->symbol_num; j++)
+			free(module->symbols[j].name);
+		free(module->symbols);
+		free(module->path);
+	}
+	free(symtab->modules);
+	free(symtab);
+}
+
+/*
+ * Function containing addr, NULL if unknown. The module basename is
+ * returned in module when the address belongs to a loaded object.
+ */
+const char* perf_symtab_resolve(struct perf_symtab *symtab, uint64_t addr, uint64_t *offset, const char **module)
+{
+	struct perf_module *p_module = NULL;
+	struct perf_symbol *sym = NULL;
+	uint64_t rel;
+	int low, high, mid;
+
+	*module = NULL;
+
+	for (int i = 0; i < symtab->module_num; i++) {
+		if (addr >= symtab->modules[i].start && addr < symtab->modules[i].end) {
+			p_module = &symtab->modules[i];
+			break;
+		}
+	}
+	if (!p_module) {
+		// Skid may land a user space sample on the kernel entry.
+		if (addr >> 63)
+			*module = "kernel";
+		return NULL;
+	}
+
+	*module = strrchr(p_module->path, '/') ? strrchr(p_module->path, '/') + 1 : p_module->path;
+
+	if (!p_module->loaded)
+		__load_module(p_module);
+
+	// Nearest symbol at or below the address.
+	rel = addr - p_module->base;
+	low = 0;
+	high = p_module->symbol_num - 1;
+	while (low <= high) {
+		mid = (low + high) / 2;
+		if (p_module->symbols[mid].addr <= rel) {
+			sym = &p_module->symbols[mid];
+			low = mid + 1;
+		} else {
+			high = mid - 1;
+		}
+	}
+
+	if (!sym || (sym->size && rel >= sym->addr + sym->size))
+		return NULL;
+
+	*offset = rel - sym->addr;
+
+	return sym->name;
+}
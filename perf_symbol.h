@@ -0,0 +1,33 @@
+#ifndef __PERF_SYMBOL_H
+#define __PERF_SYMBOL_H
+
+#include <stdint.h>
+
+struct perf_symbol {
+	uint64_t addr;
+	uint64_t size;
+	char *name;
+};
+
+// One loaded object (the executable or a shared library) of this process.
+struct perf_module {
+	char *path;
+	uint64_t base;
+	uint64_t start;
+	uint64_t end;
+	struct perf_symbol *symbols;
+	int symbol_num;
+	int loaded;
+};
+
+struct perf_symtab {
+	struct perf_module *modules;
+	int module_num;
+};
+
+/* resolve addresses of this process against ELF symbol tables */
+struct perf_symtab* perf_symtab_create();
+void perf_symtab_destroy(struct perf_symtab *symtab);
+const char* perf_symtab_resolve(struct perf_symtab *symtab, uint64_t addr, uint64_t *offset, const char **module);
+
+#endif